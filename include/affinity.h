@@ -0,0 +1,40 @@
+#ifndef __AZURE_AFFINITY_H__
+#define __AZURE_AFFINITY_H__
+
+#include <vector>
+#include <string>
+
+namespace azure {
+
+// 调度线程的绑核策略
+struct AffinityPolicy {
+    enum Type {
+        NONE,           // 不绑定，由内核调度
+        CPU_LIST,       // 按cpus列表依次绑定到单个CPU
+        PHYSICAL_CORE,  // 每个线程一个物理核（不和其他线程共用超线程）
+        NUMA_NODE,      // 绑定到NUMA节点的所有CPU，node为-1时线程轮流分到各个节点
+    };
+
+    Type type = NONE;
+    std::vector<int> cpus;
+    int node = -1;
+
+    // 从配置 scheduler.affinity / scheduler.affinity_cpus / scheduler.affinity_node 读取
+    static AffinityPolicy FromConfig();
+    static Type TypeFromString(const std::string &str);
+    static const char *TypeToString(Type type);
+
+    // 给count个线程分配CPU集合，第i个元素为空表示第i个线程不绑定
+    std::vector<std::vector<int>> plan(size_t count) const;
+};
+
+// 当前线程绑定到cpus，成功返回true
+bool SetThreadAffinity(const std::vector<int> &cpus);
+// CPU所在的NUMA节点，不知道时返回-1
+int GetCpuNumaNode(int cpu);
+// 最后处理过这个socket收包的CPU（SO_INCOMING_CPU）所在的NUMA节点，即网卡队列所在的节点，不知道时返回-1
+int GetSocketNumaNode(int fd);
+
+}
+
+#endif
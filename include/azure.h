@@ -8,6 +8,7 @@
 #include "singleton.h"
 #include "mutex.h"
 #include "thread.h"
+#include "affinity.h"
 #include "fiber.h"
 #include "scheduler.h"
 #include "hook.h"
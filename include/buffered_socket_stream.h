@@ -0,0 +1,63 @@
+#ifndef __AZURE_BUFFERED_SOCKET_STREAM_H__
+#define __AZURE_BUFFERED_SOCKET_STREAM_H__
+
+#include <string>
+#include "socket_stream.h"
+
+namespace azure {
+
+// 带用户态缓冲的SocketStream：一次recv尽量多读进读缓冲区，后面的小读直接从缓冲区拿；
+// 小块write先攒在写缓冲区，满了或者flush时一次发出。两个缓冲区都是第一次用到时从线程本地的池里取，
+// 大小固定（stream.buffer_size），析构时还回去
+// writev/sendFile 不经过写缓冲区（先flush再直接发），析构不会flush
+class BufferedSocketStream : public SocketStream {
+public:
+    typedef std::shared_ptr<BufferedSocketStream> ptr;
+
+    BufferedSocketStream(Socket::ptr sock, bool owner=true);
+    ~BufferedSocketStream();
+
+    virtual int read(void *buffer, size_t length) override;
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+    virtual int write(const void *buffer, size_t length) override;
+    virtual int write(ByteArray::ptr ba, size_t length) override;
+    virtual int writev(const iovec *iovs, size_t iovcnt) override;
+    virtual int sendFile(int fd, uint64_t offset, uint64_t length) override;
+    // 先flush写缓冲区再关闭
+    virtual void close() override;
+
+    // 发出写缓冲区里的数据，返回发出的字节数，出错返回-1
+    int flush();
+    size_t getWriteBufferedSize() const {return m_wlen;}
+
+    // 读缓冲区里还没读走的数据，指针在下一次fill（read也可能fill）之前有效
+    const char *getReadData() const {return m_rbuf + m_rpos;}
+    size_t getReadSize() const {return m_rlen - m_rpos;}
+    // 丢掉读缓冲区前n个字节
+    void consume(size_t n);
+    // 从socket读一次追加到读缓冲区，返回读到的字节数；缓冲区满了返回-1。
+    // 只有末尾没有空间时才把未读数据挪到开头，所以未consume的数据不会被覆盖
+    int fill();
+
+    // 不消费数据，缓冲区里没有时读一次socket，最多拷length字节
+    int peek(void *buffer, size_t length);
+    // 等到缓冲区里出现delim，返回到delim结尾为止的长度，数据留在缓冲区（用getReadData访问）；
+    // 对端关闭返回0，出错或者max_length字节内没有delim返回-1
+    int peekUntil(const std::string &delim, size_t max_length);
+    // 同peekUntil，把数据（含delim）读到out里
+    int readUntil(std::string &out, const std::string &delim, size_t max_length);
+
+    static size_t GetBufferSize();
+
+protected:
+    char *m_rbuf = nullptr;
+    size_t m_rpos = 0;
+    size_t m_rlen = 0;
+    char *m_wbuf = nullptr;
+    size_t m_wlen = 0;
+    size_t m_capacity;
+};
+
+}
+
+#endif
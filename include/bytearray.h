@@ -13,17 +13,17 @@ class ByteArray {
 public:
     typedef std::shared_ptr<ByteArray> ptr;
 
+    // 一块数据，内存来自线程本地的池，ByteArray析构或clear时还回去
     struct Node {
-        Node(size_t s);
-        Node();
-        ~Node();
+        Node(char *p, size_t s);
 
         char *ptr;
-        Node *next;
         size_t size;
     };
 
-    ByteArray(size_t basesize=4096);
+    // contiguous为true时只有一块连续内存，放不下时按两倍扩容并拷贝，适合小消息；
+    // 否则按basesize分块，扩容不拷贝
+    ByteArray(size_t basesize=4096, bool contiguous=false);
     ~ByteArray();
 
     // write
@@ -83,6 +83,7 @@ public:
     std::string readStringVint();
 
     // 内部操作
+    // 只保留第一块，其他块还给池
     void clear();
 
     void write(const void *buf, size_t size);
@@ -113,10 +114,13 @@ public:
     uint64_t getWriteBuffers(std::vector<iovec> &buffers, uint64_t len);
 
     size_t getSize() const {return m_size;}
+    bool isContiguous() const {return m_contiguous;}
 
 private:
     void addCapacity(size_t size);
     size_t getCapacity() const {return m_capacity - m_position;}
+    // position所在的块的下标和块内偏移
+    void locate(size_t position, size_t &index, size_t &offset) const;
 
 private:
     size_t m_basesize;
@@ -124,8 +128,8 @@ private:
     size_t m_capacity;
     size_t m_size;          // 真实数据大小
     int8_t m_endian;
-    Node *m_root;           // 数据链表表头
-    Node *m_cur;            // 当前读到的节点
+    bool m_contiguous;
+    std::vector<Node> m_nodes;  // 数据块，按位置直接算下标，不用从头遍历
 };
 
 }
@@ -0,0 +1,57 @@
+#ifndef __AZURE_FCONTEXT_H__
+#define __AZURE_FCONTEXT_H__
+
+#include <stddef.h>
+
+// 协程上下文切换的实现，编译时选择：
+// 默认在 x86_64 / aarch64 上使用汇编实现，只保存被调用者保存的寄存器，不需要 rt_sigprocmask 系统调用
+// 定义 AZURE_USE_UCONTEXT（cmake -DAZURE_FIBER_CONTEXT=ucontext）或其他架构时回退到 ucontext
+#if !defined(AZURE_USE_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define AZURE_USE_UCONTEXT
+#endif
+
+#ifdef AZURE_USE_UCONTEXT
+#include <ucontext.h>
+#endif
+
+namespace azure {
+
+#ifdef AZURE_USE_UCONTEXT
+typedef ucontext_t fcontext_t;
+#else
+typedef void *fcontext_t;   // 切出时保存的栈顶指针，寄存器都保存在栈上
+#endif
+
+}
+
+#ifndef AZURE_USE_UCONTEXT
+extern "C" {
+// 保存当前上下文到 *from，切换到 to
+void azure_jump_fcontext(void **from, void *to);
+// 在 [stack, stack + size) 上构造初始上下文，第一次切换进去时执行 fn
+void *azure_make_fcontext(void *stack, size_t size, void (*fn)());
+}
+#endif
+
+namespace azure {
+
+// 获取当前线程的上下文（主协程用）
+bool init_fcontext(fcontext_t *ctx);
+// 在 [stack, stack + size) 上创建上下文，切换进去后执行 fn
+bool make_fcontext(fcontext_t *ctx, void *stack, size_t size, void (*fn)());
+// 当前使用的实现名称
+const char *fcontext_backend();
+
+// 保存当前上下文到 from，切换到 to
+inline bool jump_fcontext(fcontext_t *from, fcontext_t *to) {
+#ifdef AZURE_USE_UCONTEXT
+    return swapcontext(from, to) == 0;
+#else
+    azure_jump_fcontext(from, *to);
+    return true;
+#endif
+}
+
+}
+
+#endif
@@ -2,58 +2,70 @@
 #define __AZURE_FDMANAGER_H__
 
 #include <memory>
+#include <atomic>
 #include "mutex.h"
 #include "iomanager.h"
 #include "singleton.h"
+#include "fdtable.h"
 
 namespace azure {
 
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+// FdCtx 不会被释放，fd关闭后同一个对象留给之后打开的同号fd复用（类型稳定），
+// 跨越挂起持有指针时用getGeneration()判断是不是还是原来的fd
+class FdCtx {
+friend class FdManager;
 public:
-    typedef std::shared_ptr<FdCtx> ptr;
-
     FdCtx(int fd);
     ~FdCtx();
 
     bool init();
-    bool isInit() const {return m_isInit;}
-    bool isSocket() const {return m_isSocket;}
+    bool isInit() const {return m_isInit.load(std::memory_order_relaxed);}
+    bool isSocket() const {return m_isSocket.load(std::memory_order_relaxed);}
     bool isClosed() const {return m_isClosed;}
-    bool close();
+    uint32_t getGeneration() const {return m_generation;}
+    bool close();        // 标记已关闭，被唤醒的IO不会再重新注册事件，返回之前是否已经关闭
 
-    void setUserNonblock(bool v) {m_userNonblock = v;}
-    bool getUserNonblock() const {return m_userNonblock;}
+    void setUserNonblock(bool v) {m_userNonblock.store(v, std::memory_order_relaxed);}
+    bool getUserNonblock() const {return m_userNonblock.load(std::memory_order_relaxed);}
 
-    void setSysNonblock(bool v) {m_sysNonblock = v;}
-    bool getSysNonblock() const {return m_sysNonblock;}
+    void setSysNonblock(bool v) {m_sysNonblock.store(v, std::memory_order_relaxed);}
+    bool getSysNonblock() const {return m_sysNonblock.load(std::memory_order_relaxed);}
 
     void setTimeout(int type, uint64_t v);
     uint64_t getTimeout(int type);
 
 private:
-    bool m_isInit: 1;   // 表示占用1个比特位
-    bool m_isSocket: 1;
-    bool m_sysNonblock: 1;
-    bool m_userNonblock: 1;
-    bool m_isClosed: 1;
+    // 同号的新fd复用这个对象，nonblock_socket为true时已知是非阻塞的socket，不用fstat/fcntl
+    void reopen(bool nonblock_socket=false);
+
+private:
+    // reopen时还拿着旧指针的协程可能正在读下面这些字段，之后才用代数判断是否作废，
+    // 所以都用relaxed原子量，读到新旧值都行，但不能是数据竞争
+    std::atomic<bool> m_isInit;
+    std::atomic<bool> m_isSocket;
+    std::atomic<bool> m_sysNonblock;
+    std::atomic<bool> m_userNonblock;
+    std::atomic<bool> m_isClosed;
+    std::atomic<uint32_t> m_generation{0};  // 每复用一次加1
     int m_fd;
-    uint64_t m_readTimeout;
-    uint64_t m_sendTimeout;
+    std::atomic<uint64_t> m_readTimeout;
+    std::atomic<uint64_t> m_sendTimeout;
     azure::IOManager *m_iomanager;
 };
 
 class FdManager {
 public:
-    typedef RWMutex RWMutexType;
-
-    FdManager();
+    typedef Mutex MutexType;
 
-    FdCtx::ptr get(int fd, bool auto_create=false);
+    // 无锁、无引用计数，返回的指针一直有效；fd没有被hook管理或者已经关闭时返回nullptr
+    FdCtx *get(int fd, bool auto_create=false);
+    // fd是刚创建的非阻塞socket（accept4等带SOCK_NONBLOCK），复用槽位时省掉fstat和fcntl
+    FdCtx *attachSocket(int fd);
     void del(int fd);
 
 private:
-    RWMutexType m_mutex;
-    std::vector<FdCtx::ptr> m_data;
+    MutexType m_mutex;          // 只在复用已关闭的槽位时使用
+    FdTable<FdCtx> m_data;
 };
 
 typedef Singleton<FdManager> FdMgr;
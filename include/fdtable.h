@@ -0,0 +1,91 @@
+#ifndef __AZURE_FDTABLE_H__
+#define __AZURE_FDTABLE_H__
+
+#include <sys/resource.h>
+#include <atomic>
+#include <algorithm>
+#include "noncopyable.h"
+
+namespace azure {
+
+// 以fd为下标的两级表：第一级大小按RLIMIT_NOFILE固定，第二级每段SEGMENT_SIZE个槽位
+// 段和元素都是第一次用到时CAS装进去，之后直到析构都不会移动或释放，所以查找不用加锁，
+// 拿到的指针可以一直使用（元素被复用时由使用者自己区分新旧）
+// T 需要有 T(int fd) 构造函数
+template<class T>
+class FdTable : public Noncpoyable {
+public:
+    static const size_t SEGMENT_SHIFT = 12;
+    static const size_t SEGMENT_SIZE = 1 << SEGMENT_SHIFT;
+
+    FdTable() {
+        // fd不会超过进程的硬限制，几十KB的第一级表就能覆盖上百万个fd
+        size_t max_fd = 1 << 20;
+        struct rlimit limit;
+        if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_max != RLIM_INFINITY) {
+            max_fd = std::max<size_t>(limit.rlim_max, 1 << 16);
+        }
+        max_fd = std::min<size_t>(max_fd, 1 << 26);
+        m_segmentCount = (max_fd + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+        m_segments = new std::atomic<Slot*>[m_segmentCount]();
+    }
+
+    ~FdTable() {
+        for(size_t i = 0; i < m_segmentCount; ++i) {
+            Slot *slots = m_segments[i].load(std::memory_order_relaxed);
+            if(!slots) {
+                continue;
+            }
+            for(size_t j = 0; j < SEGMENT_SIZE; ++j) {
+                delete slots[j].load(std::memory_order_relaxed);
+            }
+            delete[] slots;
+        }
+        delete[] m_segments;
+    }
+
+    // auto_create为true时按需分配段和元素；fd超出范围或者不存在时返回nullptr
+    T *get(int fd, bool auto_create) {
+        size_t segment = (size_t)fd >> SEGMENT_SHIFT;
+        if(fd < 0 || segment >= m_segmentCount) {
+            return nullptr;
+        }
+
+        Slot *slots = m_segments[segment].load(std::memory_order_acquire);
+        if(!slots) {
+            if(!auto_create) {
+                return nullptr;
+            }
+            Slot *new_slots = new Slot[SEGMENT_SIZE]();
+            // 其他线程抢先装好了就用它的
+            if(m_segments[segment].compare_exchange_strong(slots, new_slots, std::memory_order_acq_rel)) {
+                slots = new_slots;
+            }
+            else {
+                delete[] new_slots;
+            }
+        }
+
+        Slot &slot = slots[fd & (SEGMENT_SIZE - 1)];
+        T *item = slot.load(std::memory_order_acquire);
+        if(!item && auto_create) {
+            T *new_item = new T(fd);
+            if(slot.compare_exchange_strong(item, new_item, std::memory_order_acq_rel)) {
+                item = new_item;
+            }
+            else {
+                delete new_item;
+            }
+        }
+        return item;
+    }
+
+private:
+    typedef std::atomic<T*> Slot;
+    std::atomic<Slot*> *m_segments = nullptr;
+    size_t m_segmentCount = 0;
+};
+
+}
+
+#endif
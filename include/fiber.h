@@ -2,8 +2,9 @@
 #define __AZURE_FIBER_H__
 
 #include <memory>
+#include <atomic>
 #include <functional>
-#include <ucontext.h>   // 提供上下文切换的函数
+#include "fcontext.h"    // 提供上下文切换的函数
 #include "thread.h"
 
 namespace azure {
@@ -53,7 +54,10 @@ private:
     uint64_t m_id = 0;                      // 协程id
     uint32_t m_stacksize = 0;               // 栈大小
     State m_state = INIT;                   // 协程状态
-    ucontext_t m_ctx;                       // 协程上下文
+    // 由Scheduler::run维护：0 不在调度线程上；1 已经swapIn，切出后的状态还没处理完；
+    // 大于1 期间被其他线程调度了，值为指定的线程id+3，等run处理完再入队
+    std::atomic<int> m_handoff{0};
+    fcontext_t m_ctx;                       // 协程上下文
     void *m_stack = nullptr;                // 栈基址
     std::function<void()> m_cb;             // 协程要执行的函数
 
@@ -4,9 +4,11 @@
 #include <memory>
 #include <string>
 #include <map>
+#include <vector>
 #include <iostream>
 #include <sstream>
 #include <boost/lexical_cast.hpp>
+#include "http/http_header.h"
 
 namespace azure {
 
@@ -137,6 +139,24 @@ HttpMethod CharsToHttpMethod(const char *m);
 const char *HttpMethodToString(const HttpMethod &m);
 const char *HttpStatusToString(const HttpStatus &s);
 
+// 指向别处内存的字符串片段，不拥有数据（C++11没有std::string_view）
+class StringView {
+public:
+    StringView() {}
+    StringView(const char *data, size_t size) : m_data(data), m_size(size) {}
+
+    const char *data() const {return m_data;}
+    size_t size() const {return m_size;}
+    bool empty() const {return m_size == 0;}
+    std::string toString() const {return std::string(m_data, m_size);}
+    bool equalsIgnoreCase(const char *str, size_t len) const;
+    bool equalsIgnoreCase(const std::string &str) const {return equalsIgnoreCase(str.data(), str.size());}
+
+private:
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+};
+
 struct CaseInsensitiveLess {
     bool operator()(const std::string &lhs, const std::string &rhs) const;
 };
@@ -178,6 +198,7 @@ class HttpRequest {
 public:
     typedef std::shared_ptr<HttpRequest> ptr;
     typedef std::map<std::string, std::string, CaseInsensitiveLess> MapType;
+    typedef HttpHeaders HeaderMapType;
 
     // 默认http1.1，非长连接
     HttpRequest(uint8_t version=0x11, bool close=true);
@@ -185,22 +206,38 @@ public:
     HttpMethod getMethod() const {return m_method;}
     HttpStatus getStatus() const {return m_status;}
     uint8_t getVersion() const {return m_version;}
-    const std::string &getPath() const {return m_path;}
-    const std::string &getQuery() const {return m_query;}
-    const std::string &getFragment() const {return m_fragment;}
+    const std::string &getPath() const;
+    const std::string &getQuery() const;
+    const std::string &getFragment() const;
     const std::string &getBody() const {return m_body;}
-    const MapType &getHeaders() const {return m_headers;}
+    const HeaderMapType &getHeaders() const;
     const MapType &getParams() const {return m_params;}
     const MapType &getCookies() const {return m_cookies;}
 
+    // 不拷贝的访问方式：解析出来的请求直接指向接收缓冲区，只在请求处理期间有效
+    StringView getPathView() const;
+    StringView getQueryView() const;
+    // 找到返回true，val指向头部的值
+    bool getHeaderView(const std::string &key, StringView &val) const;
+
     void setMethod(HttpMethod v) {m_method = v;}
     void setStatus(HttpStatus v) {m_status = v;}
     void setVersion(uint8_t v) {m_version = v;}
-    void setPath(const std::string &v) {m_path = v;}
-    void setQuery(const std::string &v) {m_query = v;}
-    void setFragment(const std::string &v) {m_fragment = v;}
+    void setPath(const std::string &v) {m_path = v; m_lazy &= ~LAZY_PATH;}
+    void setQuery(const std::string &v) {m_query = v; m_lazy &= ~LAZY_QUERY;}
+    void setFragment(const std::string &v) {m_fragment = v; m_lazy &= ~LAZY_FRAGMENT;}
     void setBody(const std::string &v) {m_body = v;}
-    void setHeaders(const MapType &v) {m_headers = v;}
+    void setHeaders(const HeaderMapType &v) {m_headers = v; m_rawHeaders.clear(); m_lazy &= ~LAZY_HEADERS;}
+
+    // 解析器使用：记录指向缓冲区的片段，对应的std::string第一次访问时才生成
+    void setRawPath(const StringView &v) {m_rawPath = v; m_lazy |= LAZY_PATH;}
+    void setRawQuery(const StringView &v) {m_rawQuery = v; m_lazy |= LAZY_QUERY;}
+    void setRawFragment(const StringView &v) {m_rawFragment = v; m_lazy |= LAZY_FRAGMENT;}
+    void addRawHeader(const StringView &field, const StringView &value);
+    // 把还指向缓冲区的片段都拷贝出来，之后缓冲区可以覆盖
+    void detach();
+    // 清空内容给下一个请求复用，保留已分配的容量
+    void reset();
     void setParams(const MapType &v) {m_params = v;}
     void setCookies(const MapType &v) {m_cookies = v;}
 
@@ -225,12 +262,12 @@ public:
 
     template<typename T>
     bool checkGetHeaderAs(const std::string &key, T &val, const T &def = T()) {     // def: default
-        return checkGetAs(m_headers, key, val, def);
+        return checkGetAs(getHeaders(), key, val, def);
     }
 
     template<typename T>
     T getHeaderAs(const std::string &key, const T &def=T()) {
-        return getAs(m_headers, key, def);
+        return getAs(getHeaders(), key, def);
     }
 
     template<typename T>
@@ -255,27 +292,60 @@ public:
 
     std::ostream &dump(std::ostream &os) const;
     std::string toString() const;
+    // 请求行和头部（到空行为止）写进buf，buf先清空，容量留给下一次复用；body由调用方直接发送
+    void dumpHeader(std::string &buf) const;
+
+private:
+    // m_lazy的位：对应字段还只有原始片段
+    enum {
+        LAZY_PATH = 0x1,
+        LAZY_QUERY = 0x2,
+        LAZY_FRAGMENT = 0x4,
+        LAZY_HEADERS = 0x8,
+    };
 
 private:
     HttpMethod m_method;
     HttpStatus m_status;
     uint8_t m_version;
     bool m_close;
+    mutable uint8_t m_lazy = 0;
 
-    std::string m_path;
-    std::string m_query;
-    std::string m_fragment;
+    mutable std::string m_path;
+    mutable std::string m_query;
+    mutable std::string m_fragment;
     std::string m_body;
 
-    MapType m_headers;
+    mutable HeaderMapType m_headers;
     MapType m_params;
     MapType m_cookies;
+
+    StringView m_rawPath;
+    StringView m_rawQuery;
+    StringView m_rawFragment;
+    std::vector<std::pair<StringView, StringView>> m_rawHeaders;
+};
+
+// 用sendfile发送的文件body，最后一个引用释放时关闭fd
+class FileBody {
+public:
+    typedef std::shared_ptr<FileBody> ptr;
+
+    FileBody(int fd) : m_fd(fd) {}
+    ~FileBody();
+
+    int getFd() const {return m_fd;}
+
+private:
+    int m_fd;
 };
 
 class HttpResponse {
 public:
     typedef std::shared_ptr<HttpResponse> ptr;
-    typedef std::map<std::string, std::string, CaseInsensitiveLess> MapType;
+    typedef HttpHeaders HeaderMapType;
+    // 响应只有头部用到，和HeaderMapType相同
+    typedef HeaderMapType MapType;
 
     HttpResponse(uint8_t version=0x11, bool close=true);
 
@@ -308,14 +378,27 @@ public:
         return getAs(m_headers, key, def);
     }
 
+    // body改为文件的[offset, offset+length)，发送时由内核从page cache直接拷到socket，设置后m_body不再发送
+    void setFileBody(FileBody::ptr file, uint64_t offset, uint64_t length);
+    const FileBody::ptr &getFileBody() const {return m_file;}
+    uint64_t getFileOffset() const {return m_fileOffset;}
+    uint64_t getFileLength() const {return m_fileLength;}
+
     std::ostream &dump(std::ostream &os) const;
     std::string toString() const;
+    // 状态行和头部（到空行为止）写进buf，buf先清空，容量留给下一次复用；body由调用方直接发送
+    void dumpHeader(std::string &buf) const;
+    // 和dumpHeader一样，但追加在buf后面，用来把多个响应的头部放进同一个缓冲区
+    void appendHeader(std::string &buf) const;
 
 private:
     HttpStatus m_status;
     uint8_t m_version;
     bool m_close;
     std::string m_body;
+    FileBody::ptr m_file;
+    uint64_t m_fileOffset = 0;
+    uint64_t m_fileLength = 0;
     std::string m_reason;
     MapType m_headers;
 };
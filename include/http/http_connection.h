@@ -3,7 +3,7 @@
 
 #include <memory>
 #include <list>
-#include "socket_stream.h"
+#include "buffered_socket_stream.h"
 #include "http/http.h"
 #include "uri.h"
 #include "mutex.h"
@@ -42,7 +42,7 @@ struct HttpResult {
 
 class HttpConnectionPool;
 
-class HttpConnection : public SocketStream {
+class HttpConnection : public BufferedSocketStream {
 friend class HttpConnectionPool;
 
 public:
@@ -85,12 +85,15 @@ public:
     HttpConnection(Socket::ptr sock, bool owner=true);
     ~HttpConnection();
 
+    // 响应头直接在读缓冲区里解析，多读进来的数据留给同一连接上的下一个响应
     HttpResponse::ptr recvResponse();
+    // 头部写进复用的缓冲区，和body一起writev，body不拷贝
     int sendRequest(HttpRequest::ptr req);
 
 private:
     uint64_t m_createTime = 0;
     int32_t m_request = 0;
+    std::string m_headerBuf;
 };
 
 class HttpConnectionPool {
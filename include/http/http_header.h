@@ -0,0 +1,113 @@
+#ifndef __AZURE_HTTP_HEADER_H__
+#define __AZURE_HTTP_HEADER_H__
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+
+namespace azure {
+
+namespace http {
+
+/* 常用头部，name为小写 */
+#define HTTP_KNOWN_HEADER_MAP(XX)                       \
+  XX(HOST,                  "host")                     \
+  XX(CONNECTION,            "connection")               \
+  XX(CONTENT_LENGTH,        "content-length")           \
+  XX(CONTENT_TYPE,          "content-type")             \
+  XX(TRANSFER_ENCODING,     "transfer-encoding")        \
+  XX(USER_AGENT,            "user-agent")               \
+  XX(ACCEPT,                "accept")                   \
+  XX(ACCEPT_ENCODING,       "accept-encoding")          \
+  XX(ACCEPT_LANGUAGE,       "accept-language")          \
+  XX(ACCEPT_RANGES,         "accept-ranges")            \
+  XX(COOKIE,                "cookie")                   \
+  XX(SET_COOKIE,            "set-cookie")               \
+  XX(DATE,                  "date")                     \
+  XX(SERVER,                "server")                   \
+  XX(ETAG,                  "etag")                     \
+  XX(LAST_MODIFIED,         "last-modified")            \
+  XX(IF_NONE_MATCH,         "if-none-match")            \
+  XX(IF_MODIFIED_SINCE,     "if-modified-since")        \
+  XX(RANGE,                 "range")                    \
+  XX(CONTENT_RANGE,         "content-range")            \
+  XX(CACHE_CONTROL,         "cache-control")            \
+  XX(KEEP_ALIVE,            "keep-alive")               \
+
+enum class HttpHeaderId {
+#define XX(name, str) name,
+    HTTP_KNOWN_HEADER_MAP(XX)
+#undef XX
+    UNKNOWN
+};
+
+// 头部名字转小写后的哈希
+uint32_t HashHeaderName(const char *name, size_t len);
+// 常用头部的id，不是常用头部返回UNKNOWN；hash为HashHeaderName的结果
+HttpHeaderId GetHttpHeaderId(const char *name, size_t len, uint32_t hash);
+// 常用头部的小写名字，静态存储
+const std::string &HttpHeaderIdToString(HttpHeaderId id);
+
+// 头部表：一个请求只有十几个头部，线性表比红黑树省分配也更快。前INLINE_SIZE个放在对象内部的数组里，
+// 超过才搬到堆上；每项带着名字的小写哈希，查找先比哈希再忽略大小写比名字；常用头部额外记下位置，直接取。
+// 按插入顺序保存，名字大小写保留第一次插入时的写法；接口和原来的std::map用法兼容（find/[]/erase/遍历）
+class HttpHeaders {
+public:
+    typedef std::pair<std::string, std::string> value_type;
+    typedef value_type *iterator;
+    typedef const value_type *const_iterator;
+
+    static const size_t INLINE_SIZE = 16;
+    static const size_t KNOWN_COUNT = (size_t)HttpHeaderId::UNKNOWN;
+
+    HttpHeaders();
+    HttpHeaders(const HttpHeaders &other);
+    HttpHeaders(HttpHeaders &&other);
+    HttpHeaders &operator=(const HttpHeaders &other);
+    HttpHeaders &operator=(HttpHeaders &&other);
+    ~HttpHeaders();
+
+    iterator begin() {return m_items;}
+    iterator end() {return m_items + m_size;}
+    const_iterator begin() const {return m_items;}
+    const_iterator end() const {return m_items + m_size;}
+    size_t size() const {return m_size;}
+    bool empty() const {return m_size == 0;}
+    // 清空，已经搬到堆上的空间留着复用
+    void clear();
+
+    iterator find(const std::string &key) {return find(key.data(), key.size());}
+    const_iterator find(const std::string &key) const {return find(key.data(), key.size());}
+    iterator find(const char *key, size_t len);
+    const_iterator find(const char *key, size_t len) const;
+    // 常用头部直接按位置取
+    const_iterator find(HttpHeaderId id) const;
+    size_t count(const std::string &key) const {return find(key) != end();}
+
+    // 没有就插入一个空值
+    std::string &operator[](const std::string &key);
+    void set(const char *key, size_t klen, const char *val, size_t vlen);
+    size_t erase(const std::string &key);
+
+private:
+    size_t indexOf(const char *key, size_t len, uint32_t hash, HttpHeaderId id) const;
+    size_t append(const char *key, size_t len, uint32_t hash, HttpHeaderId id);
+    void reserve(size_t capacity);
+    void destroy();
+
+private:
+    value_type *m_items;
+    uint32_t *m_hashes;
+    size_t m_size = 0;
+    size_t m_capacity = INLINE_SIZE;
+    // 常用头部在m_items里的下标+1，0表示没有
+    uint32_t m_known[KNOWN_COUNT];
+    alignas(value_type) char m_inlineItems[INLINE_SIZE * sizeof(value_type)];
+    uint32_t m_inlineHashes[INLINE_SIZE];
+};
+
+}
+
+}
+
+#endif
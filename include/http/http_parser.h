@@ -17,6 +17,12 @@ public:
     HttpRequestParser();
 
     size_t execute(char *data, size_t len);
+    // 解析一个完整的请求头（到空行为止），path/query/头部只记录指向data的片段，data不拷贝也不移动，
+    // 请求用完之前data要保持不变；返回头部的长度
+    size_t parseView(const char *data, size_t len);
+    // 复用解析器解析下一个请求，结果写进data
+    void reset(HttpRequest::ptr data);
+    bool isView() const {return m_view;}
     int isFinished();
     int hasError();
 
@@ -37,6 +43,7 @@ private:
     // 1001: invalid version
     // 1002: invalid field
     int m_error;
+    bool m_view = false;
 };
 
 class HttpResponseParser {
@@ -46,6 +53,8 @@ public:
     HttpResponseParser();
 
     size_t execute(char *data, size_t len, bool chunk);
+    // 同execute，但不移动data里没解析的部分，data也不需要'\0'结尾，可以直接解析读缓冲区
+    size_t parse(const char *data, size_t len, bool chunk);
     int isFinished();
     int hasError();
 
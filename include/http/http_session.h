@@ -2,21 +2,99 @@
 #define __AZURE_HTTP_SESSION_H__
 
 #include <memory>
-#include "socket_stream.h"
+#include "buffered_socket_stream.h"
 #include "http/http.h"
+#include "http/http_parser.h"
 
 namespace azure {
 
 namespace http {
 
-class HttpSession : public SocketStream {
+class HttpSession;
+
+// 流式发送响应body：第一次真正发送时带上头部（Transfer-Encoding: chunked），之后每块数据一个chunk。
+// 小块先攒在缓冲区里，超过 http.response.stream_buffer_size 或者flush时才发，每个连接最多占这么多内存；
+// 发送走hook过的writev，对端收得慢时协程挂起。HTTP/1.0没有chunked，直接写body，发完关闭连接
+class HttpResponseWriter {
+public:
+    typedef std::shared_ptr<HttpResponseWriter> ptr;
+
+    // 只在本次请求的处理期间有效，session要比writer活得久
+    HttpResponseWriter(HttpSession *session, HttpResponse::ptr rsp);
+
+    // 返回写入的字节数，出错返回-1（之后的写都失败）
+    int write(const void *buffer, size_t length);
+    int write(const std::string &data) {return write(data.data(), data.size());}
+    // 发出头部和缓冲区里的数据，不等缓冲区满，用来尽早给客户端第一个字节
+    int flush();
+    // 发出剩下的数据和结束块，之后不能再写；重复调用直接返回
+    int finish();
+
+    bool isHeaderSent() const {return m_headerSent;}
+    bool isFinished() const {return m_finished;}
+    bool hasError() const {return m_error;}
+    // 已经发出的body字节数，不含chunk的分隔
+    uint64_t getBodySize() const {return m_bodySize;}
+
+private:
+    int sendChunk(const void *data, size_t length, bool last);
+
+private:
+    HttpSession *m_session;
+    HttpResponse::ptr m_rsp;
+    bool m_chunked;
+    bool m_headerSent = false;
+    bool m_finished = false;
+    bool m_error = false;
+    size_t m_bufferSize;
+    uint64_t m_bodySize = 0;
+    std::string m_buffer;
+};
+
+class HttpSession : public BufferedSocketStream {
+friend class HttpResponseWriter;
 public:
     typedef std::shared_ptr<HttpSession> ptr;
 
     HttpSession(Socket::ptr sock, bool owner=true);
+    ~HttpSession();
 
+    // 解析器和请求对象在同一个连接上复用；返回的请求里path/query/头部直接指向流的读缓冲区，
+    // 下一次recvRequest之前如果还有别人引用，会先拷贝一份再丢掉这段数据
     HttpRequest::ptr recvRequest();
-    int sendResponse(HttpResponse::ptr rsp);
+    // 头部写进复用的缓冲区，和body一起writev，body不拷贝；文件body在头部之后用sendfile发送。
+    // more为true时先攒着，和后面流水线请求的响应合成一次writev，recvRequest要等数据之前会先发出去。
+    // 失败返回<=0，连接要关闭；文件body的长度可能超过int，成功时只返回头部长度
+    int sendResponse(HttpResponse::ptr rsp, bool more=false);
+    // 发出攒着的响应，没有返回0
+    int flushResponses();
+    // 缓冲区里还有没处理的字节（流水线上的下一个请求）
+    bool hasBufferedRequest() const {return getReadSize() > m_requestEnd;}
+
+    // servlet里调用，rsp改为流式发送，状态和头部要在第一次写之前设置好；
+    // handle返回后由HttpServer调用endStream，不再sendResponse
+    HttpResponseWriter::ptr startStream(HttpResponse::ptr rsp);
+    // 当前请求的流式writer，没有返回nullptr
+    const HttpResponseWriter::ptr &getStreamWriter() const {return m_writer;}
+    // 结束当前请求的流式发送，成功返回true
+    bool endStream();
+
+private:
+    // 最多攒这么多个响应再发
+    static const size_t MAX_PENDING_RESPONSES = 64;
+
+private:
+    std::string m_headerBuf;
+    HttpResponseWriter::ptr m_writer;
+    HttpRequestParser::ptr m_parser;
+    size_t m_requestEnd = 0;            // 当前请求在读缓冲区里占的字节，下一次recvRequest时才consume
+    HttpRequest::ptr m_request;
+
+    // 攒着的响应：头部依次追加在m_outBuf里，m_pendingHeaderEnds为每个头部的结束位置
+    std::string m_outBuf;
+    std::vector<size_t> m_pendingHeaderEnds;
+    std::vector<HttpResponse::ptr> m_pending;
+    std::vector<iovec> m_iovs;
 };
 
 }
@@ -0,0 +1,63 @@
+#ifndef __AZURE_HTTP_STATIC_FILE_SERVLET_H__
+#define __AZURE_HTTP_STATIC_FILE_SERVLET_H__
+
+#include <sys/stat.h>
+#include "http/servlet.h"
+
+namespace azure {
+
+namespace http {
+
+// 发送root目录下的静态文件：body用sendfile从page cache直接发出，支持单个Range和
+// If-None-Match/If-Modified-Since；打开的fd和stat结果缓存 http.static_file.cache_ttl 毫秒，
+// 过期后stat一次确认文件没变就继续用原来的fd
+class StaticFileServlet : public Servlet {
+public:
+    typedef std::shared_ptr<StaticFileServlet> ptr;
+    typedef azure::RWMutex RWMutexType;
+
+    // prefix为注册时的uri前缀（如 /static），请求路径去掉prefix后拼到root后面
+    StaticFileServlet(const std::string &root, const std::string &prefix="");
+
+    virtual int32_t handle(azure::http::HttpRequest::ptr request,
+                           azure::http::HttpResponse::ptr response,
+                           azure::http::HttpSession::ptr session) override;
+
+    // 清空缓存，正在发送的文件不受影响
+    void clearCache();
+
+private:
+    struct FileInfo {
+        typedef std::shared_ptr<FileInfo> ptr;
+
+        FileBody::ptr file;
+        dev_t dev;
+        ino_t ino;
+        uint64_t size;
+        struct timespec mtime;
+        std::string etag;
+        std::string lastModified;
+        uint64_t expire;        // 缓存到期时间（毫秒）
+    };
+
+    FileInfo::ptr getFile(const std::string &path);
+    // old不为空时先stat，文件没变就沿用old的fd
+    FileInfo::ptr loadFile(const std::string &path, FileInfo::ptr old, uint64_t now);
+
+private:
+    std::string m_root;
+    std::string m_prefix;
+    uint64_t m_cacheTtl;
+    size_t m_cacheMax;
+    Servlet::ptr m_notFound;
+
+    RWMutexType m_mutex;
+    // 文件路径 -> 打开的文件
+    std::unordered_map<std::string, FileInfo::ptr> m_cache;
+};
+
+}
+
+}
+
+#endif
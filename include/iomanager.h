@@ -1,8 +1,11 @@
 #ifndef __AZURE_IOMANAGER_H__
 #define __AZURE_IOMANAGER_H__
 
+#include <sys/epoll.h>
 #include  "scheduler.h"
 #include "timer.h"
+#include "uring.h"
+#include "fdtable.h"
 
 namespace azure {
 
@@ -27,22 +30,30 @@ private:
             std::function<void()> cb;           // 事件的回调函数
         };
 
+        explicit FdContext(int fd_) : fd(fd_) {}
+
         EventContext &getContext(Event event);
         void resetContext(EventContext &ctx);
-        void triggerEvent(Event event);
+        // iom不为空时（idle里）事件攒进iom当前线程的批次，由idle统一投递
+        void triggerEvent(Event event, IOManager *iom = nullptr);
 
         int fd = 0;                             // 事件关联的句柄
+        int poller = -1;                        // 注册到哪个epoll，多reactor模式下fd关闭前一直属于同一个线程
         EventContext read;                      // 读事件
         EventContext write;                     // 写事件
         Event events = NONE;                    // 已注册事件
+        Event ready = NONE;                     // 持久注册模式下，已经触发但还没有人等待的事件
+        bool registered = false;                // 持久注册模式下，是否已经加入epoll
+        uint32_t generation = 0;                // 加入epoll时FdCtx的代数，不同说明fd号已经被复用
+        std::atomic<int> uringOps{0};           // 还没完成的io_uring操作数
         MutexType mutex;
     };
 
 public:
-    IOManager(size_t thread_num=1, bool use_caller=true, const std::string &name="");
+    IOManager(size_t thread_num=1, bool use_caller=true, const std::string &name="", const AffinityPolicy &affinity=AffinityPolicy::FromConfig());
     ~IOManager();
 
-    // 0 success, -1 error
+    // 0 success, 1 fd已经就绪（持久注册模式下没有cb时），调用方直接重试, -1 error
     int addEvent(int fd, Event event, std::function<void()> cb=nullptr);
     bool delEvent(int fd, Event event);
     bool cancelEvent(int fd, Event event);
@@ -50,21 +61,81 @@ public:
 
     static IOManager *GetThis();
 
+    bool isMultiReactor() const {return m_multiReactor;}
+    // 多reactor模式下轮流返回一个工作线程id，用来分发新连接；否则返回-1（任意线程）
+    // fd不为-1并且工作线程分布在多个NUMA节点上时，优先选择收包网卡队列所在节点上的线程
+    int nextReactorThread(int fd=-1);
+    // 连接默认交给thread处理；工作线程分布在多个NUMA节点上并且thread不在收包网卡队列所在的节点时，
+    // 改由nextReactorThread挑选
+    int localReactorThread(int fd, int thread);
+
+    bool useUring() const {return m_useUring;}
+    // 把op交给fd所属线程的io_uring执行，当前协程挂起直到完成，timeout_ms 为-1时不超时
+    // 返回值同io_uring的cqe->res：成功时>=0，失败时为-errno，超时或被close取消为-ECANCELED
+    int uringIO(int fd, const UringOp &op, uint64_t timeout_ms);
+
+    // idle自旋轮询的统计，所有epoll累加
+    struct PollStats {
+        uint64_t spinHits = 0;      // 自旋期间等到了事件或任务
+        uint64_t spinMisses = 0;    // 自旋预算用完，转入阻塞
+        uint64_t sleeps = 0;        // 带超时阻塞在epoll_wait上的次数
+    };
+    PollStats getPollStats() const;
+
 protected:
     void tickle() override;
+    void tickleThread(int thread) override;
+    void tickleTimerShard(int shard) override;
     bool stopping() override;
     bool stopping(uint64_t &timeout);
     void idle() override;
     void onTimerInsertedAtFront() override;
-    void contextResize(size_t size);
+    // use_caller的主线程进入run()之前不会处理自己分片上的定时器，这时加的定时器放到共享分片
+    int getTimerShard() override {return getRunningProcessorIndex();}
+
+private:
+    // 一个epoll实例和唤醒它的eventfd
+    struct Poller {
+        int epfd = -1;
+        int tickleFd = -1;                          // eventfd，用来唤醒阻塞在epoll_wait上的线程
+        std::atomic<size_t> sleepingCount{0};       // 阻塞在epoll_wait上的线程数
+        std::atomic<bool> tickled{false};           // 已经有一次唤醒还没被处理，合并后续的tickle
+        Uring::ptr uring;                           // io_uring后端，只由这个epoll所属的线程收割完成事件
+        std::atomic<uint64_t> spinHits{0};
+        std::atomic<uint64_t> spinMisses{0};
+        std::atomic<uint64_t> sleeps{0};
+
+        Poller();
+        ~Poller();
+    };
+
+    Poller *getPoller();                            // 当前线程等待的epoll
+    Poller *ownerPoller(FdContext *fd_ctx);         // fd所属的epoll，还没有时分配一个
+    bool wakePoller(Poller *poller);
+    bool updateInterest(FdContext *fd_ctx, Event events);
+    size_t reapUring(Poller *poller);
+    int spinPoll(Poller *poller, epoll_event *events, int max_events, uint64_t spin_us);
+    void cancelUring(Poller *poller, int fd);
+
+    struct UringWaiter;
 
 private:
-    int m_epollfd = 0;
-    int m_tickleFds[2];
+    // iomanager.multi_reactor 为false时所有线程共用m_pollers[0]，
+    // 为true时每个调度线程一个epoll（下标和Processor相同），fd由第一次注册事件的线程持有
+    bool m_multiReactor = false;
+    std::vector<Poller*> m_pollers;
+    std::atomic<size_t> m_nextPoller{0};            // 非调度线程注册fd时轮流分配
+    std::atomic<size_t> m_nextThread{0};
+    // iomanager.persistent_events 为true时fd第一次等待时注册读写边缘触发，关闭前不再epoll_ctl，
+    // 事件是否就绪记录在FdContext里；默认关闭
+    bool m_persistent = false;
+    // iomanager.io_uring 为true并且内核支持时，socket的IO由每个线程自己的io_uring完成，隐含多reactor模式
+    bool m_useUring = false;
+    // iomanager.spin_us 大于0时idle阻塞前先自旋轮询，每个线程的预算按最近的命中情况在(0, m_spinUs]之间调整
+    uint64_t m_spinUs = 0;
 
     std::atomic<size_t> m_pendingEventCount{0};
-    RWMutexType m_mutex;
-    std::vector<FdContext*> m_fdContexts;
+    FdTable<FdContext> m_fdContexts;                // 无锁查找，FdContext直到析构都不会释放
 };
 
 }
@@ -7,6 +7,7 @@
 #include "fiber.h"
 #include "thread.h"
 #include "mutex.h"
+#include "affinity.h"
 
 namespace azure {
 
@@ -20,10 +21,13 @@ public:
     // thread_num 管理的线程数量
     // use_caller 是否使用当前调用线程（即主线程用来进行调度）
     // name 协程调度器名称
-    Scheduler(size_t thread_num=1, bool use_caller=true, const std::string &name="");
+    // affinity start时创建的工作线程的绑核策略，默认从配置读取（use_caller的主线程不绑定）
+    Scheduler(size_t thread_num=1, bool use_caller=true, const std::string &name="", const AffinityPolicy &affinity=AffinityPolicy::FromConfig());
     virtual ~Scheduler();
 
     const std::string &getName() const {return m_name;}
+    // 所有调度线程的id，use_caller时第一个是主线程
+    const std::vector<int> &getThreadIds() const {return m_threadIds;}
 
     static Scheduler *GetThis();    // 返回当前协程调度器
     static Fiber *GetMainFiber();   // 返回当前协程调度器的调度协程
@@ -36,13 +40,13 @@ public:
     // -1: 标识任意线程
     template<typename FiberOrCb>    
     void schedule(FiberOrCb fc, int thread=-1) {
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
-        }
-        if(need_tickle) {
-            tickle();
+        if(scheduleNoLock(fc, thread)) {
+            if(thread == -1) {
+                tickle();
+            }
+            else {
+                tickleThread(thread);
+            }
         }
     }
 
@@ -50,12 +54,9 @@ public:
     template<typename InputIterator>
     void schedule(InputIterator begin, InputIterator end) {
         bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            while(begin != end) {
-                need_tickle = scheduleNoLock(&(*begin), -1) || need_tickle;
-                ++begin;
-            }
+        while(begin != end) {
+            need_tickle = scheduleNoLock(&(*begin), -1) || need_tickle;
+            ++begin;
         }
         if(need_tickle) {
             tickle();
@@ -63,71 +64,175 @@ public:
     }
 
 protected:
+    // 攒到当前线程的批次里，flushBatch时一次性放进本地队列，由当前线程接着执行（其他线程可以窃取）
+    // 不是调度线程时直接schedule
+    template<class FiberOrCb>
+    void batchSchedule(FiberOrCb fc) {
+        Processor *proc = getProcessor();
+        if(!proc) {
+            schedule(fc);
+            return;
+        }
+        FiberAndThread *ft = AllocTask();
+        ft->assign(fc, -1);
+        if(!ft->fiber && !ft->cb) {
+            FreeTask(ft);
+            return;
+        }
+        if(ft->fiber && deferSchedule(ft->fiber.get(), -1)) {
+            FreeTask(ft);
+            return;
+        }
+        proc->batch.push_back(ft);
+        ++proc->batchCount;
+    }
+    void flushBatch();
+
     virtual void tickle();      // 通知协程调度器有任务了
+    virtual void tickleThread(int thread) {tickle();}  // 通知指定线程有任务了
     void run();                 // 协程调度函数
     virtual bool stopping();    // 返回是否可以停止
     virtual void idle();        // 空闲协程，没有任务做时运行该协程
     void setThis();             // 设置当前的协程调度器
     bool hasIdleThreads() {return m_idleThreadCount > 0;}
+    bool hasRunnableTask();     // 当前线程是否有可以执行（包括可以窃取）的任务
+    int getProcessorIndex();    // 当前线程在调度器里的下标，不是调度线程返回-1
+    int getProcessorIndex(int thread);  // 指定线程在调度器里的下标
+    int getProcessorThread(int index);  // 下标对应的线程id，线程还没启动返回-1
+    int getRunningProcessorIndex();     // 同getProcessorIndex()，但线程还没进入或者已经退出run()时返回-1
+    size_t getProcessorCount() const {return m_processors.size();}
 
 private:
-    // 向协程队列添加一个协程
+    // 向协程队列添加一个协程，返回是否需要通知其他线程
+    // 名字沿用以前的，实际上本地队列是无锁的，只有全局队列和指定线程的队列需要加锁
     template<class FiberOrCb>
     bool scheduleNoLock(FiberOrCb fc, int thread) {
-        // 从无到有才进行通知
-        bool need_tickle = m_fibers.empty();
-        FiberAndThread ft(fc, thread);
+        FiberAndThread *ft = AllocTask();
+        ft->assign(fc, thread);
         // 确保fc是fiber或者callback
-        if(ft.fiber || ft.cb) {
-            m_fibers.push_back(ft);
+        if(!ft->fiber && !ft->cb) {
+            FreeTask(ft);
+            return false;
         }
-        return need_tickle;
+        // 协程还没从上一次执行里切出去，交给正在执行它的线程处理完再入队
+        if(ft->fiber && deferSchedule(ft->fiber.get(), thread)) {
+            FreeTask(ft);
+            return false;
+        }
+        return enqueue(ft);
     }
 
 private:
+    // 任务节点，自带next指针（侵入式链表），节点由线程局部的空闲链表复用
     struct FiberAndThread {
         Fiber::ptr fiber;
         std::function<void()> cb;
         int thread;
+        FiberAndThread *next = nullptr;
 
-        FiberAndThread(Fiber::ptr f, int thr)
-            : fiber(f), thread(thr) {
+        FiberAndThread()
+            : thread(-1) {
         }
 
-        FiberAndThread(Fiber::ptr *f, int thr)
-            : thread(thr) {
-            fiber.swap(*f);  // 涉及到引用释放的问题
+        void assign(Fiber::ptr f, int thr) {
+            fiber.swap(f);
+            thread = thr;
         }
 
-        FiberAndThread(std::function<void()> f, int thr)
-            : cb(f), thread(thr) {
+        void assign(Fiber::ptr *f, int thr) {
+            fiber.swap(*f);  // 涉及到引用释放的问题
+            thread = thr;
         }
 
-        FiberAndThread(std::function<void()> *f, int thr)
-        : thread(thr) {
-            cb.swap(*f);
+        void assign(std::function<void()> f, int thr) {
+            cb.swap(f);
+            thread = thr;
         }
 
-        FiberAndThread()
-            : thread(-1) {
+        void assign(std::function<void()> *f, int thr) {
+            cb.swap(*f);
+            thread = thr;
         }
 
         void reset() {
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
+            next = nullptr;
         }
     };
 
+    // FiberAndThread的侵入式FIFO链表，入队出队不需要分配内存
+    struct TaskList {
+        FiberAndThread *head = nullptr;
+        FiberAndThread *tail = nullptr;
+
+        bool empty() const {return head == nullptr;}
+        void push_back(FiberAndThread *ft);
+        FiberAndThread *pop_front();
+        FiberAndThread *pop_thread(int thread_id);  // 取出第一个可以在thread_id上执行的任务
+    };
+
+    // 每个工作线程的本地队列，有界无锁环形队列
+    // 只有属主线程入队（写tail），属主线程和窃取线程通过CAS head出队
+    class LocalQueue {
+    public:
+        static const uint32_t CAPACITY = 256;
+
+        LocalQueue();
+
+        bool push(FiberAndThread *ft);          // 只能由属主线程调用，队列满时返回false
+        FiberAndThread *pop();                  // 属主线程出队
+        uint32_t stealInto(LocalQueue &dst);    // 把一半任务偷到dst，由dst的属主线程调用
+        uint32_t size() const;
+
+    private:
+        std::atomic<uint32_t> m_head;
+        char m_pad[64];                         // head和tail分开在不同的cache line，减少伪共享
+        std::atomic<uint32_t> m_tail;
+        std::atomic<FiberAndThread*> m_buf[CAPACITY];
+    };
+
+    // 工作线程的调度上下文
+    struct Processor {
+        LocalQueue runq;                            // 本地任务，可以被其他线程窃取
+        MutexType mutex;
+        TaskList pinned;                            // 指定在该线程执行的任务，不会被窃取
+        std::atomic<size_t> pinnedCount{0};
+        std::atomic<int> threadId{-1};              // 绑定的线程id
+        TaskList batch;                             // batchSchedule攒的任务，只有属主线程访问
+        size_t batchCount = 0;
+    };
+
+    bool enqueue(FiberAndThread *ft);               // 返回是否需要tickle
+    bool deferSchedule(Fiber *fiber, int thread);   // 协程正在被run执行时记下调度请求，返回是否已记下
+    void releaseFiber(const Fiber::ptr &fiber);     // run处理完切出的协程后调用，补上期间的调度
+    FiberAndThread *dequeue(Processor *proc, bool &tickle_me);
+    FiberAndThread *popGlobal();
+    FiberAndThread *steal(Processor *proc);
+    Processor *findProcessor(int thread);
+    Processor *getProcessor();                      // 当前线程的Processor，不属于该调度器时返回nullptr
+
+    struct TaskCache;
+    static TaskCache *GetTaskCache();
+    static FiberAndThread *AllocTask();             // 优先从线程局部的空闲链表取节点
+    static void FreeTask(FiberAndThread *ft);       // 归还到当前线程的空闲链表
+
 private:
     MutexType m_mutex;
     std::vector<Thread::ptr> m_threads;             // 线程池
-    std::list<FiberAndThread> m_fibers;             // 即将要执行的协程队列
+    std::vector<Processor*> m_processors;           // 每个线程一个，use_caller时下标0是主线程
+    TaskList m_fibers;                              // 全局队列：非调度线程投递的任务、本地队列溢出的任务
+    std::atomic<size_t> m_globalCount{0};           // 全局队列长度
+    std::atomic<size_t> m_taskCount{0};             // 所有队列里的任务总数
     Fiber::ptr m_rootFiber;                         // use_caller为true时有效，调度协程
     std::string m_name;                             // 协程调度器名称
+    AffinityPolicy m_affinity;
 
 protected:
     std::vector<int> m_threadIds;                   // 协程下的线程id数组
+    std::vector<int> m_threadNodes;                 // 和m_threadIds一一对应，线程绑定的NUMA节点，没绑定为-1
+    bool m_numaSpread = false;                      // 工作线程绑定在不止一个NUMA节点上
     size_t m_threadCount = 0;                       // 线程数量
     std::atomic<size_t> m_activeThreadCount = {0};  // 工作线程数量
     std::atomic<size_t> m_idleThreadCount = {0};    // 空闲线程数量
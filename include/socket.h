@@ -58,8 +58,15 @@ public:
     }
 
     Socket::ptr accept();
-
-    bool bind(const Address::ptr addr);
+    // 等到第一个连接后不再挂起，把积压的连接一次取完，最多max个，追加到socks里，返回取到的个数
+    size_t accept(std::vector<Socket::ptr> &socks, size_t max);
+    // 在监听socket上设置accept出来的连接的读超时：内核里的SO_RCVTIMEO由新连接继承，
+    // hook层的超时在accept时直接写入，不用对每个连接setsockopt；监听socket自己的accept不受影响
+    void setAcceptedRecvTimeout(uint64_t v);
+    uint64_t getAcceptedRecvTimeout() const {return m_acceptedRecvTimeout;}
+
+    // reuse_port 为true时绑定之前设置SO_REUSEPORT，多个socket可以监听同一个地址，由内核分配新连接
+    bool bind(const Address::ptr addr, bool reuse_port=false);
     bool connect(const Address::ptr addr, uint64_t timeout_ms=-1);
     bool listen(int backlog=SOMAXCONN);
     bool close();
@@ -68,6 +75,8 @@ public:
     int send(const iovec *buffers, size_t length, int flags=0);
     int sendTo(const void *buffer, size_t length, const Address::ptr to, int flags=0);
     int sendTo(const iovec *buffers, size_t length, const Address::ptr to, int flags=0);
+    // 文件in_fd从offset开始的count字节直接由内核发出（sendfile），offset会前移
+    int sendFile(int in_fd, off_t *offset, size_t count);
 
     int recv(void *buffer, size_t length, int flags=0);
     int recv(iovec *buffers, size_t length, int flags=0);   // length指iovec的个数
@@ -98,6 +107,7 @@ private:
     void initSock();
     void newSock();
     bool init(int sockfd);
+    Socket::ptr newAccepted(int sockfd);
 
 private:
     int m_sockfd;
@@ -105,6 +115,7 @@ private:
     int m_type;
     int m_protocol;
     bool m_isConnected;
+    uint64_t m_acceptedRecvTimeout;
 
     Address::ptr m_localAddress;
     Address::ptr m_remoteAddress;
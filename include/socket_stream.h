@@ -17,8 +17,14 @@ public:
     virtual int read(ByteArray::ptr ba, size_t length) override;
     virtual int write(const void *buffer, size_t length) override;
     virtual int write(ByteArray::ptr ba, size_t length) override;
+    virtual int writev(const iovec *iovs, size_t iovcnt) override;
     virtual void close() override;
 
+    // 把文件fd的[offset, offset+length)发到socket，数据不经过用户态，写满时挂起协程
+    virtual int sendFile(int fd, uint64_t offset, uint64_t length);
+    // 发满length字节，length可能超过int，所以成功返回0，出错或文件不够长返回-1
+    int sendFileFixSize(int fd, uint64_t offset, uint64_t length);
+
     Socket::ptr getSocket() const {return m_socket;}
     bool isConnected() const;
 
@@ -2,6 +2,7 @@
 #define __AZURE_STREAM_H__
 
 #include <memory>
+#include <sys/uio.h>
 #include "bytearray.h"
 
 namespace azure {
@@ -21,6 +22,10 @@ public:
     virtual int write(ByteArray::ptr ba, size_t length) = 0;
     virtual int writeFixSize(const void *buffer, size_t length);
     virtual int writeFixSize(ByteArray::ptr ba, size_t length);
+    // 聚集写，默认只写第一块非空的数据
+    virtual int writev(const iovec *iovs, size_t iovcnt);
+    // 写完所有iovec，iovs会被修改
+    virtual int writevFixSize(iovec *iovs, size_t iovcnt);
 
     virtual void close() = 0;
 
@@ -29,6 +29,11 @@ public:
     void setReadTimeout(uint64_t v) {m_readTimeout = v;}
     void setName(const std::string &v) {m_name = v;}
 
+    // 多监听模式：bind时给worker的每个线程各开一个SO_REUSEPORT的监听socket，
+    // 每个线程只accept自己的socket并且在本线程处理连接，由内核在线程之间分配连接；需要在bind之前设置
+    bool isReusePort() const {return m_reusePort;}
+    void setReusePort(bool v) {m_reusePort = v;}
+
     bool isStop() const {return m_isStop;}
 
 protected:
@@ -37,11 +42,13 @@ protected:
 
 private:
     std::vector<Socket::ptr> m_socks;   // 监听成功的socket
+    std::vector<int> m_sockThreads;     // 和m_socks一一对应，多监听模式下socket所属的线程id，否则为-1
     IOManager *m_ioworker;
     IOManager *m_acceptWorker;
     uint64_t m_readTimeout;
     std::string m_name;
     bool m_isStop;                      // Server是否停止
+    bool m_reusePort;
 };
 
 }
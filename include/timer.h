@@ -5,14 +5,19 @@
 #include <functional>
 #include <set>
 #include <vector>
+#include <atomic>
 #include "mutex.h"
 
 namespace azure {
 
 class TimerManager;
+class TimerSet;
+class TimerWheel;
 
 class Timer : public std::enable_shared_from_this<Timer> {
 friend class TimerManager;
+friend class TimerSet;
+friend class TimerWheel;
 
 public:
     typedef std::shared_ptr<Timer> ptr;
@@ -25,6 +30,12 @@ private:
     Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager);
     Timer(uint64_t next);
 
+    enum State {
+        ACTIVE,                             // 等待触发
+        CANCELLED,                          // 已取消
+        EXPIRED                             // 已触发（非循环定时器）
+    };
+
 private:
     bool m_recurring = false;               // 是否定义循环定时器
     uint64_t m_ms = 0;                      // 执行周期
@@ -32,17 +43,101 @@ private:
     std::function<void()> m_cb;             // 超时回调
     TimerManager *m_manager = nullptr;      // 时间管理大师
 
+    // 时间轮槽位里的侵入式链表（hlist），插入删除都是O(1)
+    Timer *m_wheelNext = nullptr;
+    Timer **m_wheelPprev = nullptr;         // 指向前一个节点的m_wheelNext或者槽位头指针
+    int m_wheelLevel = -1;                  // 所在时间轮的层级，-1表示不在时间轮里
+    Timer::ptr m_self;                      // 在时间轮里时持有自己，保证链表里的裸指针有效
+
+    // 定时器只由创建它的线程（所属分片）修改，其他线程的取消/刷新通过邮箱转交
+    std::atomic<int> m_state{ACTIVE};
+    int m_shard = -1;                       // 所属分片，-1是加锁的共享分片
+    Timer *m_mailNext = nullptr;            // 邮箱里的下一个定时器
+    Timer::ptr m_mailSelf;                  // 在邮箱里时持有自己
+    std::atomic<bool> m_inMailbox{false};
+    std::atomic<bool> m_pendingUpdate{false};
+    std::atomic<uint64_t> m_pendingMs{0};   // ~0 表示周期不变
+    std::atomic<uint64_t> m_pendingStart{0};// ~0 表示起始时间不变
+
 private:
     struct Comparator {
         bool operator()(const Timer::ptr &lhs, const Timer::ptr &rhs) const;
     };
 };
 
+// 定时器容器，由TimerManager加锁后调用
+class TimerQueue {
+public:
+    typedef std::unique_ptr<TimerQueue> ptr;
+
+    virtual ~TimerQueue() {}
+
+    virtual bool insert(const Timer::ptr &timer) = 0;   // 返回插入的是否是最早触发的定时器
+    virtual bool erase(const Timer::ptr &timer) = 0;    // 定时器不在容器里返回false
+    virtual bool empty() const = 0;
+    virtual uint64_t nextTime() = 0;                    // 下一次需要处理的时间（绝对时间，允许偏早）
+    // 取出所有 m_next <= now_ms 的定时器，rollover 时全部取出
+    virtual void listExpired(uint64_t now_ms, bool rollover, std::vector<Timer::ptr> &expired) = 0;
+};
+
+// 原来的实现，红黑树按超时时间排序，插入删除O(logn)
+class TimerSet : public TimerQueue {
+public:
+    bool insert(const Timer::ptr &timer) override;
+    bool erase(const Timer::ptr &timer) override;
+    bool empty() const override {return m_timers.empty();}
+    uint64_t nextTime() override;
+    void listExpired(uint64_t now_ms, bool rollover, std::vector<Timer::ptr> &expired) override;
+
+private:
+    std::set<Timer::ptr, Timer::Comparator> m_timers;
+};
+
+// 分层时间轮，精度1ms，插入删除O(1)
+// 第0层256个槽，每个槽1ms；第1~4层各64个槽，每个槽是下一层一整圈，可以表示约49天
+// 高层的槽在低层转完一圈时整体下放（cascade）
+class TimerWheel : public TimerQueue {
+public:
+    TimerWheel();
+    ~TimerWheel();
+
+    bool insert(const Timer::ptr &timer) override;
+    bool erase(const Timer::ptr &timer) override;
+    bool empty() const override {return m_count == 0;}
+    uint64_t nextTime() override;
+    void listExpired(uint64_t now_ms, bool rollover, std::vector<Timer::ptr> &expired) override;
+
+private:
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int ROOT_SIZE = 1 << ROOT_BITS;
+    static const int LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const int LEVELS = 5;
+
+    Timer **slotOf(int level, uint64_t tick);
+    void place(Timer *timer);               // 按到期时间挂到对应的槽位
+    void unlink(Timer *timer);
+    void cascade(int level, uint64_t tick); // 把level层对应tick的槽重新放置
+    void takeSlot(Timer **slot, std::vector<Timer::ptr> &expired);
+
+private:
+    Timer *m_root[ROOT_SIZE];
+    Timer *m_levels[LEVELS - 1][LEVEL_SIZE];
+    uint64_t m_current = 0;                 // 下一个要处理的tick（毫秒），之前的都已处理
+    uint64_t m_earliest = ~0ull;            // 已知最早的触发时间，用来判断是否需要唤醒
+    size_t m_count = 0;                     // 定时器总数
+    size_t m_rootCount = 0;                 // 第0层的定时器数
+};
+
+// 定时器按线程分片，每个线程只处理自己分片里的定时器，不需要加锁
+// 其他线程对定时器的取消、刷新投递到属主分片的无锁邮箱，属主在计算超时和处理超时前统一处理
+// 不属于任何分片的线程（如还没启动调度的主线程）使用加锁的共享分片
 class TimerManager {
 friend class Timer;
 
 public:
     typedef RWMutex RWMutexType;
+    typedef Mutex MutexType;
 
     TimerManager();
     virtual ~TimerManager();
@@ -51,24 +146,45 @@ public:
     // 条件定时器，weak_ptr当作执行条件，当智能指针计数为0时说明条件不成立了，不触发定时事件
     Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring=false);
 
-    uint64_t getNextTimer();    // 获取下一个定时器的执行时间
+    uint64_t getNextTimer();    // 获取当前线程下一个定时器的执行时间
 
-    void listExpiredCb(std::vector<std::function<void()>> &cbs);
+    void listExpiredCb(std::vector<std::function<void()>> &cbs);    // 当前线程已超时的定时器
 
     bool hasTimer();
 
 protected:
     virtual void onTimerInsertedAtFront() = 0;  // 重新设置之前 epoll_wait 设置的超时时间
-    void addTimer(Timer::ptr timer, RWMutexType::WriteLock &lock);
+    virtual int getTimerShard() {return -1;}    // 当前线程的分片下标，-1使用共享分片
+    virtual void tickleTimerShard(int shard) {} // 其他线程修改了分片里的定时器，唤醒属主重新计算超时
+    void initTimerShards(size_t count);         // 开始调度前调用，每个调度线程一个分片
 
 private:
-    bool detectClockRollover(uint64_t now_ms);  // 处理服务器时间被修改的情况
+    struct Shard {
+        TimerQueue::ptr timers;                 // timer.backend 配置：wheel（默认）或 set
+        std::atomic<Timer*> mailbox{nullptr};   // 其他线程投递过来的定时器，多生产者单消费者的无锁栈
+        std::atomic<size_t> count{0};           // 还没触发也没取消的定时器数
+        MutexType mutex;                        // 只有共享分片使用
+        bool tickled = false;
+        uint64_t previousTime = 0;
+
+        Shard();
+    };
+
+    Shard *getShard(int index);
+    void insertTimer(const Timer::ptr &timer);
+    void removeTimer(const Timer::ptr &timer);
+    // ms 或 start 为 ~0 表示不变
+    bool updateTimer(const Timer::ptr &timer, uint64_t ms, uint64_t start);
+    bool applyUpdate(Shard *shard, const Timer::ptr &timer, uint64_t ms, uint64_t start, bool *at_front=nullptr);
+    void postTimer(Shard *shard, const Timer::ptr &timer);
+    void drainMailbox(Shard *shard);
+    uint64_t nextTime(Shard *shard);
+    void listExpired(Shard *shard, std::vector<std::function<void()>> &cbs);
+    bool detectClockRollover(Shard *shard, uint64_t now_ms);  // 处理服务器时间被修改的情况
 
 private:
-    RWMutexType m_mutex;
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
-    bool m_tickled = false;
-    uint64_t m_previousTime = 0;
+    std::vector<Shard*> m_shards;
+    Shard m_shared;
 };
 
 }
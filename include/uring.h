@@ -0,0 +1,109 @@
+#ifndef __AZURE_URING_H__
+#define __AZURE_URING_H__
+
+#include <stdint.h>
+#include <memory>
+#include "mutex.h"
+#include "noncopyable.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define AZURE_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifndef AZURE_HAVE_IO_URING
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+namespace azure {
+
+// 交给io_uring执行的一次IO操作，由hook填写，字段含义和io_uring_sqe相同
+struct UringOp {
+    uint8_t opcode = 0;
+    uint32_t msg_flags = 0;     // send/recv/sendmsg/recvmsg的flags，accept的flags
+    uint64_t addr = 0;          // 缓冲区、msghdr或者sockaddr
+    uint32_t len = 0;
+    uint64_t addr2 = 0;         // accept的socklen_t*
+};
+
+// io_uring的简单封装，直接使用系统调用，不依赖liburing
+// 提交队列可以被多个线程写入（持有getMutex()），完成队列只由创建它的线程读取
+class Uring : public Noncpoyable {
+public:
+    typedef std::shared_ptr<Uring> ptr;
+    typedef Spinlock MutexType;
+
+    // 内核或编译环境不支持时返回nullptr
+    static Uring::ptr Create(uint32_t entries);
+    ~Uring();
+
+    int getFd() const {return m_fd;}
+    MutexType &getMutex() {return m_mutex;}
+
+    // 取一个清零的sqe，提交队列满时先提交，调用时持有getMutex()
+    io_uring_sqe *getSqe();
+    // 提交所有还没提交的sqe，调用时持有getMutex()，返回提交的个数，失败返回-errno
+    int submit();
+    // 已经填写还没提交的sqe个数
+    uint32_t pending() const {return m_sqeTail - m_submitted;}
+
+    // 取出所有完成事件，只能在创建线程调用
+    template<class Callback>
+    size_t reap(Callback cb) {
+#ifdef AZURE_HAVE_IO_URING
+        size_t count = 0;
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        while(head != tail) {
+            io_uring_cqe *cqe = &m_cqes[head & *m_cqMask];
+            cb(cqe->user_data, cqe->res);
+            ++head;
+            ++count;
+            if(head == tail) {
+                // 回调过程中可能又有新的完成事件
+                __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+                tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+            }
+        }
+        return count;
+#else
+        return 0;
+#endif
+    }
+
+private:
+    Uring() = default;
+
+private:
+    int m_fd = -1;
+    MutexType m_mutex;
+
+    void *m_sqRing = nullptr;
+    void *m_cqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe *m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    // 提交队列
+    unsigned *m_sqHead = nullptr;
+    unsigned *m_sqTail = nullptr;
+    unsigned *m_sqMask = nullptr;
+    unsigned *m_sqArray = nullptr;
+    uint32_t m_sqEntries = 0;
+    uint32_t m_sqeTail = 0;         // 已填写的sqe
+    uint32_t m_submitted = 0;       // 已交给内核的sqe
+
+    // 完成队列
+    unsigned *m_cqHead = nullptr;
+    unsigned *m_cqTail = nullptr;
+    unsigned *m_cqMask = nullptr;
+    io_uring_cqe *m_cqes = nullptr;
+};
+
+}
+
+#endif
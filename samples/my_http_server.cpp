@@ -1,5 +1,6 @@
 #include "http/http_server.h"
 #include "log.h"
+#include "config.h"
 
 azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
 
@@ -29,8 +30,25 @@ void run() {
     http_server->start();
 }
 
+// my_http_server [线程数] [multi|uring] [persistent] [reuseport]
 int main(int argc, char **argv) {
-    azure::IOManager iom(3);
+    size_t threads = argc > 1 ? atoi(argv[1]) : 3;
+    for(int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "multi") {
+            azure::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(true);
+        }
+        else if(arg == "uring") {
+            azure::Config::Lookup<bool>("iomanager.io_uring")->setValue(true);
+        }
+        else if(arg == "persistent") {
+            azure::Config::Lookup<bool>("iomanager.persistent_events")->setValue(true);
+        }
+        else if(arg == "reuseport") {
+            azure::Config::Lookup<bool>("tcp_server.reuse_port")->setValue(true);
+        }
+    }
+    azure::IOManager iom(threads);
     iom.schedule(run);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,215 @@
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/sysinfo.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fstream>
+#include <map>
+#include <algorithm>
+#include "affinity.h"
+#include "config.h"
+#include "log.h"
+
+namespace azure {
+
+static azure::Logger::ptr g_logger = AZURE_LOG_NAME("system");
+
+static ConfigVar<std::string>::ptr g_scheduler_affinity = Config::Lookup<std::string>("scheduler.affinity", "none", "worker thread affinity: none, cpu_list, physical_core, numa_node");
+static ConfigVar<std::vector<int>>::ptr g_scheduler_affinity_cpus = Config::Lookup("scheduler.affinity_cpus", std::vector<int>(), "cpus used by cpu_list affinity");
+static ConfigVar<int>::ptr g_scheduler_affinity_node = Config::Lookup<int>("scheduler.affinity_node", -1, "numa node used by numa_node affinity, -1 spreads threads over all nodes");
+
+struct CpuInfo {
+    int cpu;
+    int core;       // 物理核id，同一个package内唯一
+    int package;
+    int node;
+};
+
+static int ReadInt(const std::string &path, int def) {
+    std::ifstream ifs(path);
+    int val = def;
+    if(!(ifs >> val)) {
+        return def;
+    }
+    return val;
+}
+
+// /sys/devices/system/cpu/cpuN 下面有指向所在节点的 nodeX 链接
+static int LoadCpuNode(int cpu) {
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR *dir = opendir(path.c_str());
+    if(!dir) {
+        return -1;
+    }
+    int node = -1;
+    while(dirent *dp = readdir(dir)) {
+        if(strncmp(dp->d_name, "node", 4) == 0 && dp->d_name[4] >= '0' && dp->d_name[4] <= '9') {
+            node = atoi(dp->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+struct CpuTopology {
+    std::vector<int> nodes;         // 下标为cpu
+    std::vector<CpuInfo> allowed;   // 进程允许使用的CPU
+
+    CpuTopology() {
+        int count = get_nprocs_conf();
+        nodes.resize(count, -1);
+        for(int i = 0; i < count; ++i) {
+            nodes[i] = LoadCpuNode(i);
+        }
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if(sched_getaffinity(0, sizeof(set), &set)) {
+            AZURE_LOG_WARN(g_logger) << "sched_getaffinity errno=" << errno << " errstr=" << strerror(errno);
+            return;
+        }
+        for(int i = 0; i < count && i < CPU_SETSIZE; ++i) {
+            if(!CPU_ISSET(i, &set)) {
+                continue;
+            }
+            std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(i) + "/topology/";
+            allowed.push_back({i, ReadInt(path + "core_id", i), ReadInt(path + "physical_package_id", 0), nodes[i]});
+        }
+    }
+};
+
+// 第一次用到时读取，之后不变
+static const CpuTopology &GetTopology() {
+    static CpuTopology s_topology;
+    return s_topology;
+}
+
+AffinityPolicy AffinityPolicy::FromConfig() {
+    AffinityPolicy policy;
+    policy.type = TypeFromString(g_scheduler_affinity->getValue());
+    policy.cpus = g_scheduler_affinity_cpus->getValue();
+    policy.node = g_scheduler_affinity_node->getValue();
+    return policy;
+}
+
+AffinityPolicy::Type AffinityPolicy::TypeFromString(const std::string &str) {
+    if(str == "cpu_list") {
+        return CPU_LIST;
+    }
+    if(str == "physical_core") {
+        return PHYSICAL_CORE;
+    }
+    if(str == "numa_node") {
+        return NUMA_NODE;
+    }
+    if(!str.empty() && str != "none") {
+        AZURE_LOG_WARN(g_logger) << "unknown affinity policy: " << str;
+    }
+    return NONE;
+}
+
+const char *AffinityPolicy::TypeToString(Type type) {
+    switch(type) {
+        case CPU_LIST:
+            return "cpu_list";
+        case PHYSICAL_CORE:
+            return "physical_core";
+        case NUMA_NODE:
+            return "numa_node";
+        default:
+            return "none";
+    }
+}
+
+std::vector<std::vector<int>> AffinityPolicy::plan(size_t count) const {
+    std::vector<std::vector<int>> result(count);
+    const std::vector<CpuInfo> &allowed = GetTopology().allowed;
+    switch(type) {
+        case CPU_LIST:
+            for(size_t i = 0; i < count && !cpus.empty(); ++i) {
+                result[i].push_back(cpus[i % cpus.size()]);
+            }
+            break;
+        case PHYSICAL_CORE: {
+            // 每个物理核取第一个逻辑CPU，按节点排好，线程多于核数时从头再来
+            std::map<std::pair<int, int>, const CpuInfo*> cores;
+            for(auto &i : allowed) {
+                cores.emplace(std::make_pair(i.package, i.core), &i);
+            }
+            std::vector<const CpuInfo*> firsts;
+            for(auto &i : cores) {
+                firsts.push_back(i.second);
+            }
+            std::stable_sort(firsts.begin(), firsts.end(), [](const CpuInfo *a, const CpuInfo *b) {
+                return a->node < b->node;
+            });
+            for(size_t i = 0; i < count && !firsts.empty(); ++i) {
+                result[i].push_back(firsts[i % firsts.size()]->cpu);
+            }
+            break;
+        }
+        case NUMA_NODE: {
+            std::map<int, std::vector<int>> nodes;
+            for(auto &i : allowed) {
+                if(node < 0 || i.node == node) {
+                    nodes[i.node].push_back(i.cpu);
+                }
+            }
+            if(nodes.empty()) {
+                AZURE_LOG_WARN(g_logger) << "no allowed cpu on numa node " << node;
+                break;
+            }
+            auto it = nodes.begin();
+            for(size_t i = 0; i < count; ++i) {
+                result[i] = it->second;
+                if(++it == nodes.end()) {
+                    it = nodes.begin();
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return result;
+}
+
+bool SetThreadAffinity(const std::vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus) {
+        if(cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(rt) {
+        AZURE_LOG_WARN(g_logger) << "pthread_setaffinity_np rt=" << rt << " errstr=" << strerror(rt);
+        return false;
+    }
+    return true;
+}
+
+int GetCpuNumaNode(int cpu) {
+    const std::vector<int> &nodes = GetTopology().nodes;
+    if(cpu < 0 || cpu >= (int)nodes.size()) {
+        return -1;
+    }
+    return nodes[cpu];
+}
+
+int GetSocketNumaNode(int fd) {
+#ifdef SO_INCOMING_CPU
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if(getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0) {
+        return GetCpuNumaNode(cpu);
+    }
+#endif
+    return -1;
+}
+
+}
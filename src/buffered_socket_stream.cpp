@@ -0,0 +1,214 @@
+#include <string.h>
+#include <algorithm>
+#include "buffered_socket_stream.h"
+#include "config.h"
+
+namespace azure {
+
+static ConfigVar<uint32_t>::ptr g_stream_buffer_size = Config::Lookup<uint32_t>("stream.buffer_size", 16 * 1024, "read/write buffer size of BufferedSocketStream");
+static ConfigVar<uint32_t>::ptr g_stream_buffer_pool = Config::Lookup<uint32_t>("stream.buffer_pool", 64, "free stream buffers kept per thread");
+
+// 线程本地的空闲缓冲块，只缓存一种大小；连接在别的线程上释放时就归到那个线程
+struct StreamBufferPool {
+    size_t size = 0;
+    std::vector<char*> free;
+
+    ~StreamBufferPool() {
+        for(auto i : free) {
+            delete[] i;
+        }
+    }
+};
+
+static thread_local StreamBufferPool t_buffer_pool;
+
+static char *AllocStreamBuffer(size_t size) {
+    StreamBufferPool &pool = t_buffer_pool;
+    if(pool.size == size && !pool.free.empty()) {
+        char *buf = pool.free.back();
+        pool.free.pop_back();
+        return buf;
+    }
+    return new char[size];
+}
+
+static void FreeStreamBuffer(char *buf, size_t size) {
+    if(!buf) {
+        return;
+    }
+    StreamBufferPool &pool = t_buffer_pool;
+    if(pool.free.empty()) {
+        pool.size = size;
+    }
+    if(pool.size != size || pool.free.size() >= g_stream_buffer_pool->getValue()) {
+        delete[] buf;
+        return;
+    }
+    pool.free.push_back(buf);
+}
+
+size_t BufferedSocketStream::GetBufferSize() {
+    return g_stream_buffer_size->getValue();
+}
+
+BufferedSocketStream::BufferedSocketStream(Socket::ptr sock, bool owner)
+    : SocketStream(sock, owner)
+    , m_capacity(GetBufferSize()) {
+}
+
+BufferedSocketStream::~BufferedSocketStream() {
+    FreeStreamBuffer(m_rbuf, m_capacity);
+    FreeStreamBuffer(m_wbuf, m_capacity);
+}
+
+int BufferedSocketStream::read(void *buffer, size_t length) {
+    if(getReadSize() == 0) {
+        // 大块直接读到用户的内存里，省一次拷贝
+        if(length >= m_capacity) {
+            return SocketStream::read(buffer, length);
+        }
+        int rt = fill();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    size_t n = std::min(length, getReadSize());
+    memcpy(buffer, getReadData(), n);
+    consume(n);
+    return n;
+}
+
+int BufferedSocketStream::read(ByteArray::ptr ba, size_t length) {
+    if(getReadSize() == 0) {
+        return SocketStream::read(ba, length);
+    }
+    size_t n = std::min(length, getReadSize());
+    ba->write(getReadData(), n);
+    consume(n);
+    return n;
+}
+
+int BufferedSocketStream::write(const void *buffer, size_t length) {
+    if(m_wlen + length > m_capacity && flush() < 0) {
+        return -1;
+    }
+    if(length >= m_capacity) {
+        return SocketStream::write(buffer, length);
+    }
+    if(!m_wbuf) {
+        m_wbuf = AllocStreamBuffer(m_capacity);
+    }
+    memcpy(m_wbuf + m_wlen, buffer, length);
+    m_wlen += length;
+    return length;
+}
+
+int BufferedSocketStream::write(ByteArray::ptr ba, size_t length) {
+    if(flush() < 0) {
+        return -1;
+    }
+    return SocketStream::write(ba, length);
+}
+
+int BufferedSocketStream::writev(const iovec *iovs, size_t iovcnt) {
+    if(flush() < 0) {
+        return -1;
+    }
+    return SocketStream::writev(iovs, iovcnt);
+}
+
+int BufferedSocketStream::sendFile(int fd, uint64_t offset, uint64_t length) {
+    if(flush() < 0) {
+        return -1;
+    }
+    return SocketStream::sendFile(fd, offset, length);
+}
+
+void BufferedSocketStream::close() {
+    flush();
+    SocketStream::close();
+}
+
+int BufferedSocketStream::flush() {
+    size_t offset = 0;
+    while(offset < m_wlen) {
+        int rt = SocketStream::write(m_wbuf + offset, m_wlen - offset);
+        if(rt <= 0) {
+            // 没发完的丢掉，连接已经不能用了
+            m_wlen = 0;
+            return -1;
+        }
+        offset += rt;
+    }
+    m_wlen = 0;
+    return offset;
+}
+
+void BufferedSocketStream::consume(size_t n) {
+    m_rpos += std::min(n, getReadSize());
+}
+
+int BufferedSocketStream::fill() {
+    if(!m_rbuf) {
+        m_rbuf = AllocStreamBuffer(m_capacity);
+    }
+    if(m_rlen == m_capacity) {
+        if(m_rpos == 0) {
+            return -1;
+        }
+        memmove(m_rbuf, m_rbuf + m_rpos, m_rlen - m_rpos);
+        m_rlen -= m_rpos;
+        m_rpos = 0;
+    }
+    int rt = SocketStream::read(m_rbuf + m_rlen, m_capacity - m_rlen);
+    if(rt > 0) {
+        m_rlen += rt;
+    }
+    return rt;
+}
+
+int BufferedSocketStream::peek(void *buffer, size_t length) {
+    if(getReadSize() == 0) {
+        int rt = fill();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    size_t n = std::min(length, getReadSize());
+    memcpy(buffer, getReadData(), n);
+    return n;
+}
+
+int BufferedSocketStream::peekUntil(const std::string &delim, size_t max_length) {
+    size_t from = 0;
+    while(true) {
+        size_t size = getReadSize();
+        if(size >= from + delim.size()) {
+            const char *p = (const char *)memmem(getReadData() + from, size - from, delim.data(), delim.size());
+            if(p) {
+                size_t n = p - getReadData() + delim.size();
+                return n <= max_length ? n : -1;
+            }
+            // delim可能跨两次读
+            from = size - delim.size() + 1;
+        }
+        if(size >= max_length) {
+            return -1;
+        }
+        int rt = fill();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+}
+
+int BufferedSocketStream::readUntil(std::string &out, const std::string &delim, size_t max_length) {
+    int rt = peekUntil(delim, max_length);
+    if(rt > 0) {
+        out.assign(getReadData(), rt);
+        consume(rt);
+    }
+    return rt;
+}
+
+}
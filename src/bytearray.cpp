@@ -2,52 +2,88 @@
 #include <fstream>
 #include <sstream>
 #include <iomanip>
-#include <cmath>
+#include <algorithm>
+#include <unordered_map>
 #include "bytearray.h"
 #include "endian_.h"
 #include "log.h"
+#include "config.h"
 
 namespace azure {
 
 static azure::Logger::ptr g_logger = AZURE_LOG_NAME("system");
 
-ByteArray::Node::Node(size_t s) 
-    : ptr(new char[s])
-    , next(nullptr)
-    , size(s) {
-}
+static azure::ConfigVar<uint32_t>::ptr g_bytearray_pool_size =
+    azure::Config::Lookup<uint32_t>("bytearray.pool_size", 64, "free blocks of each size kept per thread for ByteArray");
+static azure::ConfigVar<uint64_t>::ptr g_bytearray_pool_bytes =
+    azure::Config::Lookup<uint64_t>("bytearray.pool_bytes", 4 * 1024 * 1024, "max bytes of free ByteArray blocks kept per thread");
+
+// 线程本地的空闲块，按大小分开放；ByteArray在哪个线程释放就还到哪个线程。
+// 只缓存basesize大小的块，连续模式扩容出来的任意大小的块直接释放
+struct ByteArrayBlockPool {
+    std::unordered_map<size_t, std::vector<char*> > free;
+    size_t bytes = 0;
+
+    ~ByteArrayBlockPool() {
+        for(auto &i : free) {
+            for(auto p : i.second) {
+                delete[] p;
+            }
+        }
+    }
+};
 
-ByteArray::Node::Node()
-    : ptr(nullptr)
-    , next(nullptr)
-    , size(0) {
+static thread_local ByteArrayBlockPool t_block_pool;
+
+static char *AllocBlock(size_t size) {
+    ByteArrayBlockPool &pool = t_block_pool;
+    auto it = pool.free.find(size);
+    if(it != pool.free.end()) {
+        char *ptr = it->second.back();
+        it->second.pop_back();
+        if(it->second.empty()) {
+            pool.free.erase(it);
+        }
+        pool.bytes -= size;
+        return ptr;
+    }
+    return new char[size];
 }
 
-ByteArray::Node::~Node() {
-    if(ptr) {
-        delete[] ptr;
+static void FreeBlock(const ByteArray::Node &node, size_t basesize) {
+    ByteArrayBlockPool &pool = t_block_pool;
+    if(node.size != basesize || pool.bytes + node.size > g_bytearray_pool_bytes->getValue()) {
+        delete[] node.ptr;
+        return;
     }
-    // size = 0;
-    // ptr = nullptr
-    // next = nullptr;
+    auto it = pool.free.find(node.size);
+    size_t count = it == pool.free.end() ? 0 : it->second.size();
+    if(count >= g_bytearray_pool_size->getValue()) {
+        delete[] node.ptr;
+        return;
+    }
+    pool.free[node.size].push_back(node.ptr);
+    pool.bytes += node.size;
 }
 
-ByteArray::ByteArray(size_t basesize) 
+ByteArray::Node::Node(char *p, size_t s)
+    : ptr(p)
+    , size(s) {
+}
+
+ByteArray::ByteArray(size_t basesize, bool contiguous)
     : m_basesize(basesize)
     , m_position(0)
     , m_capacity(basesize)
     , m_size(0)
     , m_endian(AZURE_BIG_ENDIAN)
-    , m_root(new Node(basesize))
-    , m_cur(m_root) {
+    , m_contiguous(contiguous) {
+    m_nodes.push_back(Node(AllocBlock(basesize), basesize));
 }
 
 ByteArray::~ByteArray() {
-    Node *tmp = m_root;
-    while(tmp) {
-        m_cur = tmp;
-        tmp = tmp->next;
-        delete m_cur;
+    for(auto &i : m_nodes) {
+        FreeBlock(i, m_basesize);
     }
 }
 
@@ -334,18 +370,24 @@ std::string ByteArray::readStringVint() {
     return buf;
 }
 
-// 只保留第一个数据节点，清理其他节点
 void ByteArray::clear() {
     m_position = m_size = 0;
-    m_capacity = m_basesize;
-    Node *tmp = m_root->next;
-    while(tmp) {
-        m_cur = tmp;
-        tmp = tmp->next;
-        delete m_cur;
+    for(size_t i = 1; i < m_nodes.size(); ++i) {
+        FreeBlock(m_nodes[i], m_basesize);
+    }
+    m_nodes.erase(m_nodes.begin() + 1, m_nodes.end());
+    m_capacity = m_nodes[0].size;
+}
+
+void ByteArray::locate(size_t position, size_t &index, size_t &offset) const {
+    if(m_contiguous) {
+        index = 0;
+        offset = position;
+    }
+    else {
+        index = position / m_basesize;
+        offset = position % m_basesize;
     }
-    m_cur = m_root;
-    m_root->next = nullptr;
 }
 
 void ByteArray::write(const void *buf, size_t size) {
@@ -354,29 +396,17 @@ void ByteArray::write(const void *buf, size_t size) {
     }
     addCapacity(size);
 
-    size_t npos = m_position % m_basesize;  // 当前所在的节点的相对位置
-    size_t ncap = m_cur->size - npos;       // 当前节点剩余容量
-    size_t bpos = 0;
-
+    size_t index, npos;
+    locate(m_position, index, npos);
+    const char *src = (const char*)buf;
+    m_position += size;
     while(size > 0) {
-        if(ncap >= size) {
-            memcpy(m_cur->ptr + npos, (const char*)buf + bpos, size);
-            if(m_cur->size == (npos + size)) {
-                m_cur = m_cur->next;
-            }
-            m_position += size;
-            bpos += size;
-            size = 0;
-        }
-        else {
-            memcpy(m_cur->ptr + npos, (const char*)buf + bpos, ncap);
-            m_position += ncap;
-            bpos += ncap;
-            size -= ncap;
-            m_cur = m_cur->next;
-            ncap = m_cur->size;
-            npos = 0;
-        }
+        const Node &node = m_nodes[index++];
+        size_t len = std::min(size, node.size - npos);
+        memcpy(node.ptr + npos, src, len);
+        src += len;
+        size -= len;
+        npos = 0;
     }
 
     if(m_position > m_size) {
@@ -388,62 +418,25 @@ void ByteArray::read(void *buf, size_t size) {
     if(size > getReadSize()) {
         throw std::out_of_range("not enough len");
     }
-
-    size_t npos = m_position % m_basesize;
-    size_t ncap = m_cur->size - npos;
-    size_t bpos = 0;
-
-    while(size > 0) {
-        if(ncap >= size) {
-            memcpy((char*)buf + bpos, m_cur->ptr + npos, size);
-            if(m_cur->size == (npos + size)) {
-                m_cur = m_cur->next;
-            }
-            m_position += size;
-            bpos += size;
-            size = 0;
-        }
-        else {
-            memcpy((char*)buf + bpos, m_cur->ptr + npos, ncap);
-            m_position += ncap;
-            bpos += ncap;
-            size -= ncap;
-            m_cur = m_cur->next;
-            ncap = m_cur->size;
-            npos = 0;
-        }
-    }
+    read(buf, size, m_position);
+    m_position += size;
 }
 
 void ByteArray::read(void *buf, size_t size, size_t position) const {
-    if(size > (m_size - position)) {
+    if(position > m_size || size > (m_size - position)) {
         throw std::out_of_range("not enough len");
     }
 
-    size_t npos = position % m_basesize;
-    size_t ncap = m_cur->size - npos;
-    size_t bpos = 0;
-    Node *cur = m_cur;
-
+    size_t index, npos;
+    locate(position, index, npos);
+    char *dst = (char*)buf;
     while(size > 0) {
-        if(ncap >= size) {
-            memcpy((char*)buf + bpos, cur->ptr + npos, size);
-            if(cur->size == (npos + size)) {
-                cur = cur->next;
-            }
-            position += size;
-            bpos += size;
-            size = 0;
-        }
-        else {
-            memcpy((char*)buf + bpos, cur->ptr + npos, ncap);
-            position += ncap;
-            bpos += ncap;
-            size -= ncap;
-            cur = cur->next;
-            ncap = cur->size;
-            npos = 0;
-        }
+        const Node &node = m_nodes[index++];
+        size_t len = std::min(size, node.size - npos);
+        memcpy(dst, node.ptr + npos, len);
+        dst += len;
+        size -= len;
+        npos = 0;
     }
 }
 
@@ -455,14 +448,6 @@ void ByteArray::setPosition(size_t v) {
     if(m_position > m_size) {
         m_size = m_position;
     }
-    m_cur = m_root;
-    while(v > m_cur->size) {
-        v -= m_cur->size;
-        m_cur = m_cur->next;
-    }
-    if(v == m_cur->size) {
-        m_cur = m_cur->next;
-    }
 }
 
 bool ByteArray::writeToFile(const std::string &name) const {
@@ -473,18 +458,10 @@ bool ByteArray::writeToFile(const std::string &name) const {
         return false;
     }
 
-    int64_t read_size = getReadSize();
-    int64_t pos = m_position;
-    Node *cur = m_cur;
-
-    while(read_size > 0) {
-        int diff = pos % m_basesize;
-        int64_t len = (read_size > (int64_t)m_basesize ? m_basesize : read_size) - diff;
-
-        ofs.write(cur->ptr + diff, len);
-        cur = cur->next;
-        pos += len;
-        read_size -= len;
+    std::vector<iovec> buffers;
+    getReadBuffers(buffers, getReadSize(), m_position);
+    for(auto &i : buffers) {
+        ofs.write((const char*)i.iov_base, i.iov_len);
     }
     return true;
 }
@@ -514,26 +491,22 @@ void ByteArray::addCapacity(size_t size) {
         return;
     }
 
-    size = size - old_cap;
-    size_t count = ceil(1.0 * size / m_basesize);
-    Node *tmp = m_root;
-    while(tmp->next) {
-        tmp = tmp->next;
+    if(m_contiguous) {
+        // 两倍扩容，已有数据拷到新的块里
+        size_t cap = std::max(m_capacity * 2, m_position + size);
+        Node node(AllocBlock(cap), cap);
+        memcpy(node.ptr, m_nodes[0].ptr, m_size);
+        FreeBlock(m_nodes[0], m_basesize);
+        m_nodes[0] = node;
+        m_capacity = cap;
+        return;
     }
 
-    Node *first = nullptr;
+    size_t count = (size - old_cap + m_basesize - 1) / m_basesize;
     for(size_t i = 0; i < count; ++i) {
-        tmp->next = new Node(m_basesize);
-        if(first == nullptr) {
-            first = tmp->next;
-        }
-        tmp = tmp->next;
+        m_nodes.push_back(Node(AllocBlock(m_basesize), m_basesize));
         m_capacity += m_basesize;
     }
-
-    if(old_cap == 0) {
-        m_cur = first;
-    }
 }
 
 std::string ByteArray::toString() const {
@@ -561,72 +534,28 @@ std::string ByteArray::toHexString() const {
 }
 
 uint64_t ByteArray::getReadBuffers(std::vector<iovec> &buffers, uint32_t len) const {
-    len = len > getReadSize() ? getReadSize() : len;
-    if(len == 0) {
-        return 0;
-    }
-
-    uint64_t size = len;
-
-    size_t npos = m_position % m_basesize;
-    size_t ncap = m_cur->size - npos;
-    struct iovec iov;
-    Node * cur = m_cur;
-
-    while(len > 0) {
-        if(ncap >= len) {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = len;
-            len = 0;
-        }
-        else {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = ncap;
-            len -= ncap;
-            cur = cur->next;
-            ncap = cur->size;
-            npos = 0;
-        }
-
-        buffers.push_back(iov);
-    }
-    return size;
+    return getReadBuffers(buffers, len, m_position);
 }
 
 uint64_t ByteArray::getReadBuffers(std::vector<iovec> &buffers, uint32_t len, uint64_t position) const {
-    len = len > getReadSize() ? getReadSize() : len;
-    if(len == 0) {
+    if(position > m_size) {
         return 0;
     }
-
-    uint64_t size = len;
-
-    size_t npos = position % m_basesize;
-    size_t count = position / m_basesize;
-    Node *cur = m_root;
-    while(count > 0) {
-        cur = cur->next;
-        --count;
+    uint64_t size = std::min<uint64_t>(len, m_size - position);
+    if(size == 0) {
+        return 0;
     }
 
-    size_t ncap = cur->size - npos;
+    size_t index, npos;
+    locate(position, index, npos);
+    uint64_t left = size;
     struct iovec iov;
-
-    while(len > 0) {
-        if(ncap >= len) {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = len;
-            len = 0;
-        }
-        else {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = ncap;
-            len -= ncap;
-            cur = cur->next;
-            ncap = cur->size;
-            npos = 0;
-        }
-
+    while(left > 0) {
+        const Node &node = m_nodes[index++];
+        iov.iov_base = node.ptr + npos;
+        iov.iov_len = std::min<uint64_t>(left, node.size - npos);
+        left -= iov.iov_len;
+        npos = 0;
         buffers.push_back(iov);
     }
     return size;
@@ -637,30 +566,20 @@ uint64_t ByteArray::getWriteBuffers(std::vector<iovec> &buffers, uint64_t len) {
         return 0;
     }
     addCapacity(len);
-    uint64_t size = len;
 
-    size_t npos = m_position % m_basesize;
-    size_t ncap = m_cur->size - npos;
+    size_t index, npos;
+    locate(m_position, index, npos);
+    uint64_t left = len;
     struct iovec iov;
-    Node *cur = m_cur;
-    while(len > 0) {
-        if(ncap >= len) {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = len;
-            len = 0;
-        }
-        else {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = ncap;
-
-            len -= ncap;
-            cur = cur->next;
-            ncap = cur->size;
-            npos = 0;
-        }
+    while(left > 0) {
+        const Node &node = m_nodes[index++];
+        iov.iov_base = node.ptr + npos;
+        iov.iov_len = std::min<uint64_t>(left, node.size - npos);
+        left -= iov.iov_len;
+        npos = 0;
         buffers.push_back(iov);
     }
-    return size;
+    return len;
 }
 
-}
\ No newline at end of file
+}
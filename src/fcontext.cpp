@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include "fcontext.h"
+
+namespace azure {
+
+#ifdef AZURE_USE_UCONTEXT
+
+bool init_fcontext(fcontext_t *ctx) {
+    return getcontext(ctx) == 0;
+}
+
+bool make_fcontext(fcontext_t *ctx, void *stack, size_t size, void (*fn)()) {
+    if(getcontext(ctx)) {
+        return false;
+    }
+    ctx->uc_link = nullptr;             // 后继上下文
+    ctx->uc_stack.ss_sp = stack;        // 栈空间基址
+    ctx->uc_stack.ss_size = size;       // 栈大小
+    makecontext(ctx, fn, 0);
+    return true;
+}
+
+const char *fcontext_backend() {
+    return "ucontext";
+}
+
+#else
+
+bool init_fcontext(fcontext_t *ctx) {
+    // 汇编实现切出时才保存上下文，这里不需要做任何事
+    *ctx = nullptr;
+    return true;
+}
+
+bool make_fcontext(fcontext_t *ctx, void *stack, size_t size, void (*fn)()) {
+    *ctx = azure_make_fcontext(stack, size, fn);
+    return *ctx != nullptr;
+}
+
+const char *fcontext_backend() {
+#if defined(__x86_64__)
+    return "asm-x86_64";
+#else
+    return "asm-aarch64";
+#endif
+}
+
+#endif
+
+}
+
+#ifndef AZURE_USE_UCONTEXT
+
+#if defined(__CET__)
+#define AZURE_ENDBR "    endbr64\n"
+#else
+#define AZURE_ENDBR
+#endif
+
+#if defined(__x86_64__)
+
+// 栈布局（低地址 -> 高地址）：
+// mxcsr/x87控制字, r12, r13, r14, r15, rbx, rbp, 返回地址
+// 新上下文的返回地址是 azure_fcontext_entry，r12 保存入口函数
+__asm__(
+    ".text\n"
+    ".globl azure_jump_fcontext\n"
+    ".type azure_jump_fcontext,@function\n"
+    ".align 16\n"
+"azure_jump_fcontext:\n"
+    AZURE_ENDBR
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r15\n"
+    "    pushq %r14\n"
+    "    pushq %r13\n"
+    "    pushq %r12\n"
+    "    leaq -8(%rsp), %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"       // *from = rsp
+    "    movq %rsi, %rsp\n"         // 切换到目标栈
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    leaq 8(%rsp), %rsp\n"
+    "    popq %r12\n"
+    "    popq %r13\n"
+    "    popq %r14\n"
+    "    popq %r15\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size azure_jump_fcontext,.-azure_jump_fcontext\n"
+
+    ".globl azure_fcontext_entry\n"
+    ".type azure_fcontext_entry,@function\n"
+    ".align 16\n"
+"azure_fcontext_entry:\n"
+    AZURE_ENDBR
+    "    callq *%r12\n"
+    "    ud2\n"                     // 入口函数不会返回
+    ".size azure_fcontext_entry,.-azure_fcontext_entry\n"
+);
+
+extern "C" void azure_fcontext_entry();
+
+extern "C" void *azure_make_fcontext(void *stack, size_t size, void (*fn)()) {
+    // 栈顶按16字节对齐，ret 进入 entry 后 rsp 也是16字节对齐，满足 call 的调用约定
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t *sp = (uint64_t *)(top - 16);
+    *--sp = (uint64_t)(uintptr_t)&azure_fcontext_entry;    // 返回地址
+    *--sp = 0;                          // rbp
+    *--sp = 0;                          // rbx
+    *--sp = 0;                          // r15
+    *--sp = 0;                          // r14
+    *--sp = 0;                          // r13
+    *--sp = (uint64_t)(uintptr_t)fn;    // r12
+    *--sp = ((uint64_t)0x037f << 32) | 0x1f80;  // x87控制字和mxcsr的默认值
+    return sp;
+}
+
+#elif defined(__aarch64__)
+
+// 栈布局（相对 sp）：d8-d15 [0x00, 0x40), x19-x28 [0x40, 0x90), x29 x30 [0x90, 0xa0)
+// 新上下文的 x30 是 azure_fcontext_entry，x19 保存入口函数
+__asm__(
+    ".text\n"
+    ".globl azure_jump_fcontext\n"
+    ".type azure_jump_fcontext,%function\n"
+    ".align 4\n"
+"azure_jump_fcontext:\n"
+    "    sub sp, sp, #0xb0\n"
+    "    stp d8, d9, [sp, #0x00]\n"
+    "    stp d10, d11, [sp, #0x10]\n"
+    "    stp d12, d13, [sp, #0x20]\n"
+    "    stp d14, d15, [sp, #0x30]\n"
+    "    stp x19, x20, [sp, #0x40]\n"
+    "    stp x21, x22, [sp, #0x50]\n"
+    "    stp x23, x24, [sp, #0x60]\n"
+    "    stp x25, x26, [sp, #0x70]\n"
+    "    stp x27, x28, [sp, #0x80]\n"
+    "    stp x29, x30, [sp, #0x90]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"            // *from = sp
+    "    mov sp, x1\n"              // 切换到目标栈
+    "    ldp d8, d9, [sp, #0x00]\n"
+    "    ldp d10, d11, [sp, #0x10]\n"
+    "    ldp d12, d13, [sp, #0x20]\n"
+    "    ldp d14, d15, [sp, #0x30]\n"
+    "    ldp x19, x20, [sp, #0x40]\n"
+    "    ldp x21, x22, [sp, #0x50]\n"
+    "    ldp x23, x24, [sp, #0x60]\n"
+    "    ldp x25, x26, [sp, #0x70]\n"
+    "    ldp x27, x28, [sp, #0x80]\n"
+    "    ldp x29, x30, [sp, #0x90]\n"
+    "    add sp, sp, #0xb0\n"
+    "    ret\n"
+    ".size azure_jump_fcontext,.-azure_jump_fcontext\n"
+
+    ".globl azure_fcontext_entry\n"
+    ".type azure_fcontext_entry,%function\n"
+    ".align 4\n"
+"azure_fcontext_entry:\n"
+    "    blr x19\n"
+    "    brk #0\n"                  // 入口函数不会返回
+    ".size azure_fcontext_entry,.-azure_fcontext_entry\n"
+);
+
+extern "C" void azure_fcontext_entry();
+
+extern "C" void *azure_make_fcontext(void *stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t *sp = (uint64_t *)(top - 0xb0);
+    for(int i = 0; i < 0xb0 / 8; ++i) {
+        sp[i] = 0;
+    }
+    sp[0x40 / 8] = (uint64_t)(uintptr_t)fn;                     // x19
+    sp[0x98 / 8] = (uint64_t)(uintptr_t)&azure_fcontext_entry;  // x30
+    return sp;
+}
+
+#endif
+
+#endif
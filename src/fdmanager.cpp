@@ -16,39 +16,53 @@ FdCtx::FdCtx(int fd)
     init();
 }
 
+bool FdCtx::close() {
+    return m_isClosed.exchange(true);
+}
+
+void FdCtx::reopen(bool nonblock_socket) {
+    // 先换代再清除关闭标记，还拿着旧指针的协程看到未关闭时一定也能看到新的代数
+    ++m_generation;
+    if(!nonblock_socket) {
+        m_isInit.store(false, std::memory_order_relaxed);
+        init();
+        return;
+    }
+    m_isInit.store(true, std::memory_order_relaxed);
+    m_isSocket.store(true, std::memory_order_relaxed);
+    m_sysNonblock.store(true, std::memory_order_relaxed);
+    m_userNonblock.store(false, std::memory_order_relaxed);
+    m_readTimeout.store(-1, std::memory_order_relaxed);
+    m_sendTimeout.store(-1, std::memory_order_relaxed);
+    m_isClosed = false;
+}
+
 // 初始化文件描述符类对象，如果是socket，设置成非阻塞的
 bool FdCtx::init() {
-    if(m_isInit) {
+    if(isInit()) {
         return true;
     }
-    m_readTimeout = -1;
-    m_sendTimeout = -1;
+    m_readTimeout.store(-1, std::memory_order_relaxed);
+    m_sendTimeout.store(-1, std::memory_order_relaxed);
 
     struct stat fd_stat;
-    if(-1 == fstat(m_fd, &fd_stat)) {
-        m_isInit = false;
-        m_isSocket = false;
-    }
-    else {
-        m_isInit = true;
-        m_isSocket = S_ISSOCK(fd_stat.st_mode);
-    }
+    bool is_init = -1 != fstat(m_fd, &fd_stat);
+    bool is_socket = is_init && S_ISSOCK(fd_stat.st_mode);
+    m_isInit.store(is_init, std::memory_order_relaxed);
+    m_isSocket.store(is_socket, std::memory_order_relaxed);
 
     // 如果是socket，设置成非阻塞的
-    if(m_isSocket) {
+    if(is_socket) {
         int flags = fcntl_f(m_fd, F_GETFL, 0);
         if(!(flags & O_NONBLOCK)) {
             fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
         }
-        m_sysNonblock = true;
-    }
-    else {
-        m_sysNonblock = false;
     }
+    m_sysNonblock.store(is_socket, std::memory_order_relaxed);
 
-    m_userNonblock = false;
+    m_userNonblock.store(false, std::memory_order_relaxed);
     m_isClosed = false;
-    return m_isInit;
+    return is_init;
 }
 
 FdCtx::~FdCtx() {
@@ -57,53 +71,53 @@ FdCtx::~FdCtx() {
 
 void FdCtx::setTimeout(int type, uint64_t v) {
     if(type == SO_RCVTIMEO) {
-        m_readTimeout = v;
+        m_readTimeout.store(v, std::memory_order_relaxed);
     }
     else {
-        m_sendTimeout = v;
+        m_sendTimeout.store(v, std::memory_order_relaxed);
     }
 }
 
 uint64_t FdCtx::getTimeout(int type) {
-    return type == SO_RCVTIMEO ? m_readTimeout : m_sendTimeout;
-}
-
-FdManager::FdManager() {
-    m_data.resize(64);
+    return (type == SO_RCVTIMEO ? m_readTimeout : m_sendTimeout).load(std::memory_order_relaxed);
 }
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-    if(fd == -1) {
-        return nullptr;
+FdCtx *FdManager::get(int fd, bool auto_create) {
+    FdCtx *ctx = m_data.get(fd, auto_create);
+    if(!ctx || !ctx->isClosed()) {
+        return ctx;
     }
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_data.size() <= fd) {
-        if(auto_create == false) {
-            return nullptr;
-        }
+    if(!auto_create) {
+        return nullptr;
     }
-    else {
-        if(m_data[fd] || !auto_create) {
-            return m_data[fd];
-        }
+
+    MutexType::Lock lock(m_mutex);
+    if(ctx->isClosed()) {
+        ctx->reopen();
     }
-    lock.unlock();
+    return ctx;
+}
 
-    RWMutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if(fd >= (int)m_data.size()) {
-        m_data.resize(fd * 1.5);
+FdCtx *FdManager::attachSocket(int fd) {
+    FdCtx *ctx = m_data.get(fd, false);
+    if(!ctx) {
+        // 第一次用到这个槽位，构造时按普通fd初始化
+        return get(fd, true);
+    }
+    if(ctx->isClosed()) {
+        MutexType::Lock lock(m_mutex);
+        if(ctx->isClosed()) {
+            ctx->reopen(true);
+        }
     }
-    m_data[fd] = ctx;
     return ctx;
 }
 
 void FdManager::del(int fd) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if((int)m_data.size() <= fd) {
-        return;
+    FdCtx *ctx = m_data.get(fd, false);
+    if(ctx) {
+        ctx->close();
     }
-    m_data[fd].reset();
 }
 
-}
\ No newline at end of file
+}
@@ -1,4 +1,8 @@
 #include <atomic>
+#include <vector>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "config.h"
 #include "macro.h"
 #include "fiber.h"
@@ -16,19 +20,102 @@ static thread_local Fiber::ptr t_threadFiber = nullptr;     // 主协程的智
 
 // 协程栈大小
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = Config::Lookup<uint32_t>("fiber.stack_size", 1024 * 1024, "fiber stack size");
+// 每个线程缓存的空闲协程栈个数上限，0表示不缓存
+static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_size = Config::Lookup<uint32_t>("fiber.stack_pool_size", 64, "fiber stack pool size per thread");
 
-class MallocStackAllocator {
+// mmap分配协程栈，栈底(低地址)留一页PROT_NONE作为保护页，栈溢出直接SIGSEGV而不是踩坏堆
+// 每个线程缓存一定数量的空闲栈，协程析构时归还，避免连接频繁建立/断开时反复mmap/munmap
+class MmapStackAllocator {
 public:
     static void *Alloc(size_t size) {
-        return malloc(size);
+        if(s_pool_state != POOL_DESTROYED) {
+            StackPool &pool = GetPool();
+            if(pool.size == size && !pool.free_stacks.empty()) {
+                void *vp = pool.free_stacks.back();
+                pool.free_stacks.pop_back();
+                return vp;
+            }
+        }
+
+        size_t page = PageSize();
+        void *base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(base == MAP_FAILED) {
+            AZURE_LOG_ERROR(g_logger) << "mmap fiber stack failed, size=" << size << " errno=" << errno << " errstr=" << strerror(errno);
+            throw std::bad_alloc();
+        }
+        if(mprotect(base, page, PROT_NONE)) {
+            AZURE_LOG_ERROR(g_logger) << "mprotect fiber stack guard page failed, errno=" << errno << " errstr=" << strerror(errno);
+        }
+        return (char*)base + page;
     }
 
     static void Dealloc(void *vp, size_t size) {
-        return free(vp);
+        if(s_pool_state != POOL_DESTROYED) {
+            StackPool &pool = GetPool();
+            uint32_t limit = g_fiber_stack_pool_size->getValue();
+            // 只缓存当前配置大小的栈，栈大小配置改变后旧的栈直接释放
+            if(pool.size != size && pool.free_stacks.empty()) {
+                pool.size = size;
+            }
+            if(pool.size == size && pool.free_stacks.size() < limit) {
+                pool.free_stacks.push_back(vp);
+                return;
+            }
+        }
+        Unmap(vp, size);
+    }
+
+    // 栈大小向上取整到页大小
+    static size_t RoundUp(size_t size) {
+        size_t page = PageSize();
+        return (size + page - 1) / page * page;
     }
+
+private:
+    struct StackPool {
+        size_t size = 0;
+        std::vector<void*> free_stacks;
+
+        StackPool() {
+            s_pool_state = POOL_ALIVE;
+        }
+
+        ~StackPool() {
+            // 线程退出后还在析构的协程（如静态对象持有的）直接munmap
+            s_pool_state = POOL_DESTROYED;
+            for(auto &i : free_stacks) {
+                Unmap(i, size);
+            }
+        }
+    };
+
+    static StackPool &GetPool() {
+        static thread_local StackPool s_pool;
+        return s_pool;
+    }
+
+    static size_t PageSize() {
+        static size_t s_page = sysconf(_SC_PAGESIZE);
+        return s_page;
+    }
+
+    static void Unmap(void *vp, size_t size) {
+        size_t page = PageSize();
+        munmap((char*)vp - page, size + page);
+    }
+
+private:
+    enum PoolState {
+        POOL_NONE,
+        POOL_ALIVE,
+        POOL_DESTROYED
+    };
+    static thread_local int s_pool_state;
 };
 
-using StackAllocator = MallocStackAllocator;
+thread_local int MmapStackAllocator::s_pool_state = MmapStackAllocator::POOL_NONE;
+
+using StackAllocator = MmapStackAllocator;
 
 uint64_t Fiber::GetFiberId() {
     return t_fiber ? t_fiber->GetId() : 0;
@@ -39,10 +126,10 @@ Fiber::Fiber() {
     m_state = EXEC;
     SetThis(this);
 
-    // 初始化ucp结构体，将当前的上下文保存到m_ctx中
+    // 初始化上下文，将当前的上下文保存到m_ctx中
     // 主协程没有MainFunc，不干任何事，就会返回主函数
-    if(getcontext(&m_ctx)) {    
-        AZURE_ASSERT2(false, "getcontext");
+    if(!init_fcontext(&m_ctx)) {
+        AZURE_ASSERT2(false, "init_fcontext");
     }
     ++s_fiber_count;
 
@@ -53,22 +140,11 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
     : m_id(++s_fiber_id)
     , m_cb(cb) {
     ++s_fiber_count;
-    m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
+    m_stacksize = StackAllocator::RoundUp(stacksize ? stacksize : g_fiber_stack_size->getValue());
 
     m_stack = StackAllocator::Alloc(m_stacksize);
-    if(getcontext(&m_ctx)) {
-        AZURE_ASSERT2(false, "getcontext");
-    }
-    m_ctx.uc_link = nullptr;                // 后继上下文
-    m_ctx.uc_stack.ss_sp = m_stack;         // 栈空间基址
-    m_ctx.uc_stack.ss_size = m_stacksize;   // 栈大小
-
-    if(!use_caller) {
-        // 修改通过getcontext取得的上下文m_ctx
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    }
-    else {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+    if(!make_fcontext(&m_ctx, m_stack, m_stacksize, use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc)) {
+        AZURE_ASSERT2(false, "make_fcontext");
     }
     
     // m_state = INIT;
@@ -97,16 +173,11 @@ Fiber::~Fiber() {
 
 void Fiber::reset(std::function<void()> cb) {
     AZURE_ASSERT(m_stack);
-    AZURE_ASSERT(m_state == TERM || m_state == INIT);
+    AZURE_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
     m_cb = cb;
-    if(getcontext(&m_ctx)) {
-        AZURE_ASSERT(m_state == TERM || m_state == INIT);
+    if(!make_fcontext(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc)) {
+        AZURE_ASSERT2(false, "make_fcontext");
     }
-    m_ctx.uc_link = nullptr;                // Pointer to the context that is resumed
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
     m_state = INIT;
 }
 
@@ -116,8 +187,8 @@ void Fiber::swapIn() {
     m_state = EXEC;
 
     // 第一个参数是被换出去的协程，第二个是换进来的协程
-    if(swapcontext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx)) {
-        AZURE_ASSERT2(false, "swapcontext");
+    if(!jump_fcontext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx)) {
+        AZURE_ASSERT2(false, "jump_fcontext");
     }
 }
 
@@ -125,8 +196,8 @@ void Fiber::swapIn() {
 void Fiber::swapOut() {
     // AZURE_LOG_INFO(g_logger) << "fiber swapout, out: " << m_id << ", in:" << Scheduler::GetMainFiber()->m_id;
     SetThis(Scheduler::GetMainFiber());
-    if(swapcontext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx))) {
-        AZURE_ASSERT2(false, "swapcontext");
+    if(!jump_fcontext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx))) {
+        AZURE_ASSERT2(false, "jump_fcontext");
     }
 }
 
@@ -168,15 +239,15 @@ uint64_t Fiber::TotalFibers() {
 void Fiber::call() {
     SetThis(this);
     m_state = EXEC;
-    if(swapcontext(&(t_threadFiber->m_ctx), &m_ctx)) {
-        AZURE_ASSERT2(false, "swapcontext");
+    if(!jump_fcontext(&(t_threadFiber->m_ctx), &m_ctx)) {
+        AZURE_ASSERT2(false, "jump_fcontext");
     }
 }
 
 void Fiber::back() {
     SetThis(t_threadFiber.get());
-    if(swapcontext(&m_ctx, &(t_threadFiber->m_ctx))) {
-        AZURE_ASSERT2(false, "swapcontext");
+    if(!jump_fcontext(&m_ctx, &(t_threadFiber->m_ctx))) {
+        AZURE_ASSERT2(false, "jump_fcontext");
     }
 }
 
@@ -22,6 +22,7 @@ static thread_local bool t_hook_enable = false;     // 标记当前线程是否
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
     XX(read) \
     XX(readv) \
     XX(recv) \
@@ -32,6 +33,7 @@ static thread_local bool t_hook_enable = false;     // 标记当前线程是否
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendfile) \
     XX(close) \
     XX(shutdown) \
     XX(fcntl) \
@@ -80,8 +82,9 @@ struct timer_info {
 };
 
 // 一般来说，是一个协程在执行该函数
+// uop不为空时，在io_uring后端下由内核完成这次IO，不再等待就绪后重试
 template<typename OriginFun, typename... Args>
-static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t event, int timeout_so, Args&&... args) {
+static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t event, int timeout_so, const azure::UringOp *uop, Args&&... args) {
     if(!azure::t_hook_enable) {
         // NOTE std::forward通常是用于完美转发
         // 完美转发主要目的一般都是为了避免拷贝，同时调用正确的函数版本
@@ -93,7 +96,7 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    azure::FdCtx::ptr ctx = azure::FdMgr::GetInstance()->get(fd);
+    azure::FdCtx *ctx = azure::FdMgr::GetInstance()->get(fd);
     if(!ctx) {
         return fun(fd, std::forward<Args>(args)...);
     }
@@ -108,9 +111,15 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t
     }
 
     uint64_t to = ctx->getTimeout(timeout_so);
+    uint32_t generation = ctx->getGeneration();
     std::shared_ptr<timer_info> tinfo(new timer_info);
 
 retry:
+    // 等待期间被其他协程close，同号的fd可能已经重新打开了
+    if(ctx->isClosed() || ctx->getGeneration() != generation) {
+        errno = EBADF;
+        return -1;
+    }
     ssize_t n = fun(fd, std::forward<Args>(args)...);
 
     while(n == -1 && errno == EINTR) {
@@ -118,6 +127,22 @@ retry:
     }
     if(n == -1 && errno == EAGAIN) {
         azure::IOManager* iom = azure::IOManager::GetThis();
+        if(uop && iom->useUring()) {
+            int res = iom->uringIO(fd, *uop, to);
+            if(res >= 0) {
+                return res;
+            }
+            if(res == -ECANCELED) {
+                // 超时或者fd被关闭
+                errno = (ctx->isClosed() || ctx->getGeneration() != generation) ? EBADF : ETIMEDOUT;
+                return -1;
+            }
+            if(res != -EAGAIN) {
+                errno = -res;
+                return -1;
+            }
+            // 提交队列满了，退回等待就绪
+        }
         azure::Timer::ptr timer;
         std::weak_ptr<timer_info> winfo(tinfo);
 
@@ -133,6 +158,13 @@ retry:
         }
 
         int rt = iom->addEvent(fd, (azure::IOManager::Event)(event));
+        if(rt == 1) {
+            // 在这之前已经触发过就绪，不用挂起
+            if(timer) {
+                timer->cancel();
+            }
+            goto retry;
+        }
         if(AZURE_UNLIKELY(rt)) {
             AZURE_LOG_ERROR(g_logger) << hook_fun_name << " addEvent(" << fd << ", " << event << ")";
             if(timer) {
@@ -141,6 +173,11 @@ retry:
             return -1;
         } 
         else {
+            // 注册之后再检查一次，其他线程的close可能插在上面的检查和注册之间，
+            // 不撤销的话已经关闭的fd会留在epoll里
+            if(ctx->isClosed() || ctx->getGeneration() != generation) {
+                iom->cancelAll(fd);
+            }
             azure::Fiber::YieldToHold();
             if(timer) {
                 timer->cancel();
@@ -221,7 +258,7 @@ int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen,
     if(!azure::t_hook_enable) {
         return connect_f(fd, addr, addrlen);
     }
-    azure::FdCtx::ptr ctx = azure::FdMgr::GetInstance()->get(fd);
+    azure::FdCtx *ctx = azure::FdMgr::GetInstance()->get(fd);
     if(!ctx || ctx->isClosed()) {
         errno = EBADF;
         return -1;
@@ -272,6 +309,11 @@ int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen,
             return -1;
         }
     }
+    else if(rt == 1) {  // 已经可写，连接完成
+        if(timer) {
+            timer->cancel();
+        }
+    }
     else {          // 添加失败
         if(timer) {
             timer->cancel();
@@ -298,53 +340,143 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
-    int fd = do_io(sockfd, accept_f, "accept", azure::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    return accept4(sockfd, addr, addrlen, 0);
+}
+
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    if(!azure::t_hook_enable) {
+        // 不hook也要登记FdCtx，Socket::init靠它确认是socket
+        int fd = accept4_f(sockfd, addr, addrlen, flags);
+        if(fd >= 0) {
+            azure::FdMgr::GetInstance()->get(fd, true);
+        }
+        return fd;
+    }
+    // 新连接直接以非阻塞方式创建，省掉初始化时的fcntl；用户自己要的SOCK_NONBLOCK记到用户层
+    int sys_flags = flags | SOCK_NONBLOCK;
+    azure::UringOp op;
+#ifdef AZURE_HAVE_IO_URING
+    op.opcode = IORING_OP_ACCEPT;
+    op.addr = (uint64_t)addr;
+    op.addr2 = (uint64_t)addrlen;
+    op.msg_flags = sys_flags;   // 和accept_flags共用
+#endif
+    int fd = do_io(sockfd, accept4_f, "accept4", azure::IOManager::READ, SO_RCVTIMEO, &op, addr, addrlen, sys_flags);
     if(fd >= 0) {
-        azure::FdMgr::GetInstance()->get(fd, true); // 初始化fd
+        azure::FdCtx *ctx = azure::FdMgr::GetInstance()->attachSocket(fd);
+        if(flags & SOCK_NONBLOCK) {
+            ctx->setUserNonblock(true);
+        }
     }
     return fd;
 }
 
 // read
 ssize_t read(int fd, void *buf, size_t count) {
-    return do_io(fd, read_f, "read", azure::IOManager::READ, SO_RCVTIMEO, buf, count);
+    azure::UringOp op;
+#ifdef AZURE_HAVE_IO_URING
+    op.opcode = IORING_OP_RECV;
+    op.addr = (uint64_t)buf;
+    op.len = count;
+#endif
+    return do_io(fd, read_f, "read", azure::IOManager::READ, SO_RCVTIMEO, &op, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, readv_f, "readv", azure::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+    // socket上的readv/writev等价于不带flags的recvmsg/sendmsg
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*)iov;
+    msg.msg_iovlen = iovcnt;
+    azure::UringOp op;
+#ifdef AZURE_HAVE_IO_URING
+    op.opcode = IORING_OP_RECVMSG;
+    op.addr = (uint64_t)&msg;
+    op.len = 1;
+#endif
+    return do_io(fd, readv_f, "readv", azure::IOManager::READ, SO_RCVTIMEO, &op, iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
-    return do_io(sockfd, recv_f, "recv", azure::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+    azure::UringOp op;
+#ifdef AZURE_HAVE_IO_URING
+    op.opcode = IORING_OP_RECV;
+    op.addr = (uint64_t)buf;
+    op.len = len;
+    op.msg_flags = flags;
+#endif
+    return do_io(sockfd, recv_f, "recv", azure::IOManager::READ, SO_RCVTIMEO, &op, buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
-    return do_io(sockfd, recvfrom_f, "recvfrom", azure::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+    return do_io(sockfd, recvfrom_f, "recvfrom", azure::IOManager::READ, SO_RCVTIMEO, nullptr, buf, len, flags, src_addr, addrlen);
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
-    return do_io(sockfd, recvmsg_f, "recvmsg", azure::IOManager::READ, SO_RCVTIMEO, msg, flags);
+    azure::UringOp op;
+#ifdef AZURE_HAVE_IO_URING
+    op.opcode = IORING_OP_RECVMSG;
+    op.addr = (uint64_t)msg;
+    op.len = 1;
+    op.msg_flags = flags;
+#endif
+    return do_io(sockfd, recvmsg_f, "recvmsg", azure::IOManager::READ, SO_RCVTIMEO, &op, msg, flags);
 }
 
 //write
 ssize_t write(int fd, const void *buf, size_t count) {
-    return do_io(fd, write_f, "write", azure::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+    azure::UringOp op;
+#ifdef AZURE_HAVE_IO_URING
+    op.opcode = IORING_OP_SEND;
+    op.addr = (uint64_t)buf;
+    op.len = count;
+#endif
+    return do_io(fd, write_f, "write", azure::IOManager::WRITE, SO_SNDTIMEO, &op, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, writev_f, "writev", azure::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*)iov;
+    msg.msg_iovlen = iovcnt;
+    azure::UringOp op;
+#ifdef AZURE_HAVE_IO_URING
+    op.opcode = IORING_OP_SENDMSG;
+    op.addr = (uint64_t)&msg;
+    op.len = 1;
+#endif
+    return do_io(fd, writev_f, "writev", azure::IOManager::WRITE, SO_SNDTIMEO, &op, iov, iovcnt);
 }
 
 ssize_t send(int sockfd, const void *buf, size_t len, int flags) {
-    return do_io(sockfd, send_f, "send", azure::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags);
+    azure::UringOp op;
+#ifdef AZURE_HAVE_IO_URING
+    op.opcode = IORING_OP_SEND;
+    op.addr = (uint64_t)buf;
+    op.len = len;
+    op.msg_flags = flags;
+#endif
+    return do_io(sockfd, send_f, "send", azure::IOManager::WRITE, SO_SNDTIMEO, &op, buf, len, flags);
 }
 
 ssize_t sendto(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen) {
-    return do_io(sockfd, sendto_f, "sendto", azure::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags, dest_addr, addrlen);
+    return do_io(sockfd, sendto_f, "sendto", azure::IOManager::WRITE, SO_SNDTIMEO, nullptr, buf, len, flags, dest_addr, addrlen);
 }
 
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
-    return do_io(sockfd, sendmsg_f, "sendmsg", azure::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+    azure::UringOp op;
+#ifdef AZURE_HAVE_IO_URING
+    op.opcode = IORING_OP_SENDMSG;
+    op.addr = (uint64_t)msg;
+    op.len = 1;
+    op.msg_flags = flags;
+#endif
+    return do_io(sockfd, sendmsg_f, "sendmsg", azure::IOManager::WRITE, SO_SNDTIMEO, &op, msg, flags);
+}
+
+// 目标socket写满时返回EAGAIN，和send一样挂起协程等可写，不走io_uring
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    return do_io(out_fd, sendfile_f, "sendfile", azure::IOManager::WRITE, SO_SNDTIMEO, nullptr, in_fd, offset, count);
 }
 
 // close
@@ -352,8 +484,10 @@ int close(int fd) {
     if(!azure::t_hook_enable) {
         return close_f(fd);
     }
-    azure::FdCtx::ptr ctx = azure::FdMgr::GetInstance()->get(fd);
+    azure::FdCtx *ctx = azure::FdMgr::GetInstance()->get(fd);
     if(ctx) {
+        // 先标记关闭：被cancelAll唤醒的协程可能在close_f之前重试，不能让它重新注册事件
+        ctx->close();
         auto iom = azure::IOManager::GetThis();
         if(iom) {
             iom->cancelAll(fd);
@@ -380,7 +514,7 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
             {
                 int arg = va_arg(va, int);
                 va_end(va);
-                azure::FdCtx::ptr ctx = azure::FdMgr::GetInstance()->get(fd);
+                azure::FdCtx *ctx = azure::FdMgr::GetInstance()->get(fd);
                 if(!ctx || ctx->isClosed() || !ctx->isSocket()) {
                     return fcntl_f(fd, cmd, arg);
                 }
@@ -398,7 +532,7 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
             {
                 va_end(va);
                 int arg = fcntl_f(fd, cmd);
-                azure::FdCtx::ptr ctx = azure::FdMgr::GetInstance()->get(fd);
+                azure::FdCtx *ctx = azure::FdMgr::GetInstance()->get(fd);
                 if(!ctx || ctx->isClosed() || !ctx->isSocket()) {
                     return arg;
                 }
@@ -473,7 +607,7 @@ int ioctl(int fd, unsigned long request, ...) {
 
     if(FIONBIO == request) {
         bool user_nonblock = !!*(int*)arg;
-        azure::FdCtx::ptr ctx = azure::FdMgr::GetInstance()->get(fd);
+        azure::FdCtx *ctx = azure::FdMgr::GetInstance()->get(fd);
         if(!ctx || ctx->isClosed() || !ctx->isSocket()) {
             return ioctl_f(fd, request, arg);
         }
@@ -492,7 +626,7 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     }
     if(level == SOL_SOCKET) {
         if(optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-            azure::FdCtx::ptr ctx = azure::FdMgr::GetInstance()->get(sockfd);
+            azure::FdCtx *ctx = azure::FdMgr::GetInstance()->get(sockfd);
             if(ctx) {
                 const timeval *tv = (const timeval*)optval;
                 ctx->setTimeout(optname, tv->tv_sec * 1000 + tv->tv_usec / 1000);
@@ -1,3 +1,4 @@
+#include <unistd.h>
 #include "http/http.h"
 
 namespace azure {
@@ -50,6 +51,10 @@ const char *HttpStatusToString(const HttpStatus &s) {
     }
 }
 
+bool StringView::equalsIgnoreCase(const char *str, size_t len) const {
+    return m_size == len && strncasecmp(m_data, str, len) == 0;
+}
+
 bool CaseInsensitiveLess::operator()(const std::string &lhs, const std::string &rhs) const {
     return strcasecmp(lhs.c_str(), rhs.c_str()) < 0;
 }
@@ -61,9 +66,109 @@ HttpRequest::HttpRequest(uint8_t version, bool close)
     , m_path("/") {
 }
 
-std::string HttpRequest::getHeader(const std::string &key, const std::string &def) const {
+const std::string &HttpRequest::getPath() const {
+    if(m_lazy & LAZY_PATH) {
+        m_path.assign(m_rawPath.data(), m_rawPath.size());
+        m_lazy &= ~LAZY_PATH;
+    }
+    return m_path;
+}
+
+const std::string &HttpRequest::getQuery() const {
+    if(m_lazy & LAZY_QUERY) {
+        m_query.assign(m_rawQuery.data(), m_rawQuery.size());
+        m_lazy &= ~LAZY_QUERY;
+    }
+    return m_query;
+}
+
+const std::string &HttpRequest::getFragment() const {
+    if(m_lazy & LAZY_FRAGMENT) {
+        m_fragment.assign(m_rawFragment.data(), m_rawFragment.size());
+        m_lazy &= ~LAZY_FRAGMENT;
+    }
+    return m_fragment;
+}
+
+const HttpRequest::HeaderMapType &HttpRequest::getHeaders() const {
+    if(m_lazy & LAZY_HEADERS) {
+        for(auto &i : m_rawHeaders) {
+            m_headers.set(i.first.data(), i.first.size(), i.second.data(), i.second.size());
+        }
+        m_lazy &= ~LAZY_HEADERS;
+    }
+    return m_headers;
+}
+
+StringView HttpRequest::getPathView() const {
+    if(m_lazy & LAZY_PATH) {
+        return m_rawPath;
+    }
+    return StringView(m_path.data(), m_path.size());
+}
+
+StringView HttpRequest::getQueryView() const {
+    if(m_lazy & LAZY_QUERY) {
+        return m_rawQuery;
+    }
+    return StringView(m_query.data(), m_query.size());
+}
+
+bool HttpRequest::getHeaderView(const std::string &key, StringView &val) const {
+    if(m_lazy & LAZY_HEADERS) {
+        // 同名头部以后出现的为准，和插入map时一致
+        for(auto it = m_rawHeaders.rbegin(); it != m_rawHeaders.rend(); ++it) {
+            if(it->first.equalsIgnoreCase(key)) {
+                val = it->second;
+                return true;
+            }
+        }
+        return false;
+    }
     auto it = m_headers.find(key);
-    return it == m_headers.end() ? def : it->second;
+    if(it == m_headers.end()) {
+        return false;
+    }
+    val = StringView(it->second.data(), it->second.size());
+    return true;
+}
+
+void HttpRequest::addRawHeader(const StringView &field, const StringView &value) {
+    if(!(m_lazy & LAZY_HEADERS) && !m_headers.empty()) {
+        // 已经有生成好的头部，直接加进去
+        m_headers.set(field.data(), field.size(), value.data(), value.size());
+        return;
+    }
+    m_rawHeaders.push_back(std::make_pair(field, value));
+    m_lazy |= LAZY_HEADERS;
+}
+
+void HttpRequest::detach() {
+    getPath();
+    getQuery();
+    getFragment();
+    getHeaders();
+    m_rawHeaders.clear();
+}
+
+void HttpRequest::reset() {
+    m_method = HttpMethod::GET;
+    m_version = 0x11;
+    m_close = true;
+    m_lazy = 0;
+    m_path = "/";
+    m_query.clear();
+    m_fragment.clear();
+    m_body.clear();
+    m_headers.clear();
+    m_params.clear();
+    m_cookies.clear();
+    m_rawHeaders.clear();
+}
+
+std::string HttpRequest::getHeader(const std::string &key, const std::string &def) const {
+    StringView val;
+    return getHeaderView(key, val) ? val.toString() : def;
 }
 
 std::string HttpRequest::getParam(const std::string &key, const std::string &def) const {
@@ -77,6 +182,7 @@ std::string HttpRequest::getCookie(const std::string &key, const std::string &de
 }
 
 void HttpRequest::setHeader(const std::string &key, const std::string &val) {
+    getHeaders();
     m_headers[key] = val;
 }
 
@@ -89,6 +195,7 @@ void HttpRequest::setCookie(const std::string &key, const std::string &val) {
 }
 
 void HttpRequest::delHeader(const std::string &key) {
+    getHeaders();
     m_headers.erase(key);
 }
 
@@ -101,12 +208,12 @@ void HttpRequest::delCookie(const std::string &key) {
 }
 
 bool HttpRequest::hasHeader(const std::string &key, std::string *val) const {
-    auto it = m_headers.find(key);
-    if(it == m_headers.end()) {
+    StringView view;
+    if(!getHeaderView(key, view)) {
         return false;
     }
     if(val) {
-        *val = it->second;
+        val->assign(view.data(), view.size());
     }
     return true;
 }
@@ -134,34 +241,46 @@ bool HttpRequest::hasCookie(const std::string &key, std::string *val) const {
 }
 
 std::ostream &HttpRequest::dump(std::ostream &os) const {
-    os << HttpMethodToString(m_method) << " "
-       << m_path
-       << (m_query.empty() ? "" : "?")
-       << m_query
-       << (m_fragment.empty() ? "" : "#")
-       << m_fragment
-       << " HTTP/"
-       << ((uint32_t)(m_version >> 4))
-       << "."
-       << ((uint32_t)(m_version & 0x0f))
-       << "\r\n";
-    
-    os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
+    std::string header;
+    dumpHeader(header);
+    return os << header << m_body;
+}
 
-    for(auto &i : m_headers) {
-        if(strcasecmp(i.first.c_str(), "connection") != 0) {
-            os << i.first << ": " << i.second << "\r\n";
-        }
+// "HTTP/1.1"
+static void append_version(std::string &buf, uint8_t version) {
+    buf.append("HTTP/");
+    buf.push_back('0' + (version >> 4));
+    buf.push_back('.');
+    buf.push_back('0' + (version & 0x0f));
+}
+
+void HttpRequest::dumpHeader(std::string &buf) const {
+    buf.clear();
+    buf.append(HttpMethodToString(m_method)).append(" ").append(getPath());
+    if(!getQuery().empty()) {
+        buf.append("?").append(m_query);
     }
-    
-    if(!m_body.empty()) {
-        os << "content-length: " << m_body.size() << "\r\n\r\n" << m_body;
+    if(!getFragment().empty()) {
+        buf.append("#").append(m_fragment);
     }
-    else {
-        os << "\r\n";
+    buf.append(" ");
+    append_version(buf, m_version);
+    buf.append("\r\n");
+
+    buf.append("connection: ").append(m_close ? "close" : "keep-alive").append("\r\n");
+
+    const HeaderMapType &headers = getHeaders();
+    auto conn = headers.find(HttpHeaderId::CONNECTION);
+    for(auto &i : headers) {
+        if(&i != conn) {
+            buf.append(i.first).append(": ").append(i.second).append("\r\n");
+        }
     }
 
-    return os;
+    if(!m_body.empty()) {
+        buf.append("content-length: ").append(std::to_string(m_body.size())).append("\r\n");
+    }
+    buf.append("\r\n");
 }
 
 std::string HttpRequest::toString() const {
@@ -170,6 +289,12 @@ std::string HttpRequest::toString() const {
     return ss.str();
 }
 
+FileBody::~FileBody() {
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
 HttpResponse::HttpResponse(uint8_t version, bool close)
     : m_status(HttpStatus::OK)
     , m_version(version)
@@ -189,32 +314,55 @@ void HttpResponse::delHeader(const std::string &key) {
     m_headers.erase(key);
 }
 
+void HttpResponse::setFileBody(FileBody::ptr file, uint64_t offset, uint64_t length) {
+    m_file = file;
+    m_fileOffset = offset;
+    m_fileLength = length;
+}
+
 std::ostream &HttpResponse::dump(std::ostream &os) const {
-    os << "HTTP/"
-       << ((uint32_t)(m_version >> 4))
-       << "."
-       << ((uint32_t)(m_version & 0x0f))
-       << " "
-       << (uint32_t)m_status
-       << " "
-       << (m_reason.empty() ? HttpStatusToString(m_status) : m_reason)
-       << "\r\n";
+    std::string header;
+    dumpHeader(header);
+    if(m_file) {
+        // 调试输出不读文件内容
+        return os << header << "<file fd=" << m_file->getFd() << " offset=" << m_fileOffset
+                  << " length=" << m_fileLength << ">";
+    }
+    return os << header << m_body;
+}
 
+void HttpResponse::dumpHeader(std::string &buf) const {
+    buf.clear();
+    appendHeader(buf);
+}
+
+void HttpResponse::appendHeader(std::string &buf) const {
+    append_version(buf, m_version);
+    buf.append(" ").append(std::to_string((uint32_t)m_status)).append(" ");
+    if(m_reason.empty()) {
+        buf.append(HttpStatusToString(m_status));
+    }
+    else {
+        buf.append(m_reason);
+    }
+    buf.append("\r\n");
+
+    auto conn = m_headers.find(HttpHeaderId::CONNECTION);
     for(auto &i : m_headers) {
-        if(strcasecmp(i.first.c_str(), "connection") != 0) {
-            os << i.first << ": " << i.second << "\r\n";
+        if(&i != conn) {
+            buf.append(i.first).append(": ").append(i.second).append("\r\n");
         }
     }
 
-    os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
+    buf.append("connection: ").append(m_close ? "close" : "keep-alive").append("\r\n");
 
-    if(!m_body.empty()) {
-        os << "content-length: " << m_body.size() << "\r\n\r\n" << m_body;
+    if(m_file) {
+        buf.append("content-length: ").append(std::to_string(m_fileLength)).append("\r\n");
     }
-    else {
-        os << "\r\n";
+    else if(!m_body.empty()) {
+        buf.append("content-length: ").append(std::to_string(m_body.size())).append("\r\n");
     }
-    return os;
+    buf.append("\r\n");
 }
 
 std::string HttpResponse::toString() const {
@@ -18,7 +18,7 @@ std::string HttpResult::toString() const {
 }
 
 HttpConnection::HttpConnection(Socket::ptr sock, bool owner)
-    : SocketStream(sock, owner) {
+    : BufferedSocketStream(sock, owner) {
     m_createTime = azure::GetCurrentMS();
 }
 
@@ -28,84 +28,58 @@ HttpConnection::~HttpConnection() {
 
 HttpResponse::ptr HttpConnection::recvResponse() {
     HttpResponseParser::ptr parser(new HttpResponseParser);
-    uint64_t buff_size = HttpRequestParser::GetHttpRequestBufferSize();
-    //uint64_t buff_size = 100;
-    std::shared_ptr<char> buffer(new char[buff_size + 1], [](char* ptr){delete[] ptr;});
-    char* data = buffer.get();
-    int offset = 0;
-    do {
-        int len = read(data + offset, buff_size - offset);
-        if(len <= 0) {
-            close();
-            return nullptr;
-        }
-        len += offset;
-        data[len] = '\0';
-        size_t nparse = parser->execute(data, len, false);
-        if(parser->hasError()) {
-            close();
-            return nullptr;
+    // 直接解析读缓冲区里的数据，解析过的consume掉；body和连接上后面的数据留在缓冲区里
+    size_t max_header = HttpResponseParser::GetHttpResponseBufferSize();
+    while(true) {
+        if(getReadSize() > 0) {
+            consume(parser->parse(getReadData(), getReadSize(), false));
+            if(parser->hasError()) {
+                close();
+                return nullptr;
+            }
+            if(parser->isFinished()) {
+                break;
+            }
         }
-        offset = len - nparse;
-        if(offset == (int)buff_size) {
+        // 剩下没解析完的一行太长，或者连接出错
+        if(getReadSize() >= max_header || fill() <= 0) {
             close();
             return nullptr;
         }
-        if(parser->isFinished()) {
-            break;
-        }
-    } while(true);
+    }
 
     auto& client_parser = parser->getParser();
     std::string body;
 
     if(client_parser.chunked) {
-        int len = offset;
         do {
-            bool begin = true;
-            do {
-                if(!begin || len == 0) {
-                    int rt = read(data + len, buff_size - len);
-                    if(rt <= 0) {
+            // 每个分块头都重新初始化解析器，收齐一整行之前不consume，下次从头再解析
+            while(true) {
+                if(getReadSize() > 0) {
+                    size_t nparse = parser->parse(getReadData(), getReadSize(), true);
+                    if(parser->hasError()) {
                         close();
                         return nullptr;
                     }
-                    len += rt;
-                }
-                data[len] = '\0';
-                size_t nparse = parser->execute(data, len, true);
-                if(parser->hasError()) {
-                    close();
-                    return nullptr;
+                    if(parser->isFinished()) {
+                        consume(nparse);
+                        break;
+                    }
                 }
-                len -= nparse;
-                if(len == (int)buff_size) {
+                if(getReadSize() >= max_header || fill() <= 0) {
                     close();
                     return nullptr;
                 }
-                begin = false;
-            } while(!parser->isFinished());
-            //len -= 2;
-            
-            // AZURE_LOG_DEBUG(g_logger) << "content_len=" << client_parser.content_len;
-            if(client_parser.content_len + 2 <= len) {
-                body.append(data, client_parser.content_len);
-                memmove(data, data + client_parser.content_len + 2, len - client_parser.content_len - 2);
-                len -= client_parser.content_len + 2;
-            } else {
-                body.append(data, len);
-                int left = client_parser.content_len - len + 2;
-                while(left > 0) {
-                    int rt = read(data, left > (int)buff_size ? (int)buff_size : left);
-                    if(rt <= 0) {
-                        close();
-                        return nullptr;
-                    }
-                    body.append(data, rt);
-                    left -= rt;
-                }
-                body.resize(body.size() - 2);
-                len = 0;
+            }
+
+            // 块数据和后面的\r\n：缓冲区里有的先拷走，大块的剩余部分直接读进body
+            size_t size = body.size();
+            body.resize(size + client_parser.content_len);
+            char crlf[2];
+            if((client_parser.content_len > 0 && readFixSize(&body[size], client_parser.content_len) <= 0)
+                    || readFixSize(crlf, sizeof(crlf)) <= 0) {
+                close();
+                return nullptr;
             }
         } while(!client_parser.chunks_done);
     } 
@@ -113,22 +87,9 @@ HttpResponse::ptr HttpConnection::recvResponse() {
         int64_t length = parser->getContentLength();
         if(length > 0) {
             body.resize(length);
-
-            int len = 0;
-            if(length >= offset) {
-                memcpy(&body[0], data, offset);
-                len = offset;
-            } else {
-                memcpy(&body[0], data, length);
-                len = length;
-            }
-
-            length -= offset;
-            if(length > 0) {
-                if(readFixSize(&body[len], length) <= 0) {
-                    close();
-                    return nullptr;
-                }
+            if(readFixSize(&body[0], length) <= 0) {
+                close();
+                return nullptr;
             }
         }
     }
@@ -153,11 +114,15 @@ HttpResponse::ptr HttpConnection::recvResponse() {
     return parser->getData();
 }
 
-int HttpConnection::sendRequest(HttpRequest::ptr rsp) {
-    std::stringstream ss;
-    ss << *rsp;
-    std::string data = ss.str();
-    return writeFixSize(data.c_str(), data.size());
+int HttpConnection::sendRequest(HttpRequest::ptr req) {
+    req->dumpHeader(m_headerBuf);
+    const std::string &body = req->getBody();
+    iovec iovs[2];
+    iovs[0].iov_base = (void *)m_headerBuf.data();
+    iovs[0].iov_len = m_headerBuf.size();
+    iovs[1].iov_base = (void *)body.data();
+    iovs[1].iov_len = body.size();
+    return writevFixSize(iovs, body.empty() ? 1 : 2);
 }
 
 HttpResult::ptr HttpConnection::DoGet(const std::string &url, uint64_t timeout_ms, 
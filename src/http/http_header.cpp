@@ -0,0 +1,264 @@
+#include <string.h>
+#include <strings.h>
+#include <new>
+#include "http/http_header.h"
+
+namespace azure {
+
+namespace http {
+
+static const std::string s_known_names[] = {
+#define XX(name, str) str,
+    HTTP_KNOWN_HEADER_MAP(XX)
+#undef XX
+};
+
+// FNV-1a，按小写计算
+uint32_t HashHeaderName(const char *name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < len; ++i) {
+        unsigned char c = name[i];
+        if(c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+// 常用头部按哈希放进开放寻址表，查一次通常只比较一个槽
+struct KnownHeaderTable {
+    static const size_t SLOTS = 64;
+    int8_t slots[SLOTS];
+    uint32_t hashes[HttpHeaders::KNOWN_COUNT];
+
+    KnownHeaderTable() {
+        memset(slots, -1, sizeof(slots));
+        for(size_t i = 0; i < HttpHeaders::KNOWN_COUNT; ++i) {
+            hashes[i] = HashHeaderName(s_known_names[i].data(), s_known_names[i].size());
+            size_t pos = hashes[i] & (SLOTS - 1);
+            while(slots[pos] >= 0) {
+                pos = (pos + 1) & (SLOTS - 1);
+            }
+            slots[pos] = i;
+        }
+    }
+};
+
+static const KnownHeaderTable s_known_table;
+
+HttpHeaderId GetHttpHeaderId(const char *name, size_t len, uint32_t hash) {
+    size_t pos = hash & (KnownHeaderTable::SLOTS - 1);
+    while(s_known_table.slots[pos] >= 0) {
+        int id = s_known_table.slots[pos];
+        if(s_known_table.hashes[id] == hash && s_known_names[id].size() == len
+                && strncasecmp(s_known_names[id].data(), name, len) == 0) {
+            return (HttpHeaderId)id;
+        }
+        pos = (pos + 1) & (KnownHeaderTable::SLOTS - 1);
+    }
+    return HttpHeaderId::UNKNOWN;
+}
+
+const std::string &HttpHeaderIdToString(HttpHeaderId id) {
+    static const std::string s_unknown;
+    if(id >= HttpHeaderId::UNKNOWN) {
+        return s_unknown;
+    }
+    return s_known_names[(size_t)id];
+}
+
+HttpHeaders::HttpHeaders()
+    : m_items((value_type *)m_inlineItems)
+    , m_hashes(m_inlineHashes) {
+    memset(m_known, 0, sizeof(m_known));
+}
+
+HttpHeaders::HttpHeaders(const HttpHeaders &other)
+    : HttpHeaders() {
+    *this = other;
+}
+
+HttpHeaders::HttpHeaders(HttpHeaders &&other)
+    : HttpHeaders() {
+    *this = std::move(other);
+}
+
+HttpHeaders &HttpHeaders::operator=(const HttpHeaders &other) {
+    if(this == &other) {
+        return *this;
+    }
+    clear();
+    reserve(other.m_size);
+    for(size_t i = 0; i < other.m_size; ++i) {
+        new (m_items + i) value_type(other.m_items[i]);
+        m_hashes[i] = other.m_hashes[i];
+    }
+    m_size = other.m_size;
+    memcpy(m_known, other.m_known, sizeof(m_known));
+    return *this;
+}
+
+HttpHeaders &HttpHeaders::operator=(HttpHeaders &&other) {
+    if(this == &other) {
+        return *this;
+    }
+    if(other.m_items != (value_type *)other.m_inlineItems) {
+        // 对方在堆上，直接接过来
+        destroy();
+        m_items = other.m_items;
+        m_hashes = other.m_hashes;
+        m_size = other.m_size;
+        m_capacity = other.m_capacity;
+        other.m_items = (value_type *)other.m_inlineItems;
+        other.m_hashes = other.m_inlineHashes;
+        other.m_size = 0;
+        other.m_capacity = INLINE_SIZE;
+    }
+    else {
+        clear();
+        for(size_t i = 0; i < other.m_size; ++i) {
+            new (m_items + i) value_type(std::move(other.m_items[i]));
+            m_hashes[i] = other.m_hashes[i];
+        }
+        m_size = other.m_size;
+        other.clear();
+    }
+    memcpy(m_known, other.m_known, sizeof(m_known));
+    memset(other.m_known, 0, sizeof(other.m_known));
+    return *this;
+}
+
+HttpHeaders::~HttpHeaders() {
+    destroy();
+}
+
+void HttpHeaders::clear() {
+    for(size_t i = 0; i < m_size; ++i) {
+        m_items[i].~value_type();
+    }
+    m_size = 0;
+    memset(m_known, 0, sizeof(m_known));
+}
+
+HttpHeaders::iterator HttpHeaders::find(const char *key, size_t len) {
+    uint32_t hash = HashHeaderName(key, len);
+    size_t idx = indexOf(key, len, hash, GetHttpHeaderId(key, len, hash));
+    return idx < m_size ? m_items + idx : end();
+}
+
+HttpHeaders::const_iterator HttpHeaders::find(const char *key, size_t len) const {
+    uint32_t hash = HashHeaderName(key, len);
+    size_t idx = indexOf(key, len, hash, GetHttpHeaderId(key, len, hash));
+    return idx < m_size ? m_items + idx : end();
+}
+
+HttpHeaders::const_iterator HttpHeaders::find(HttpHeaderId id) const {
+    if(id >= HttpHeaderId::UNKNOWN || m_known[(size_t)id] == 0) {
+        return end();
+    }
+    return m_items + m_known[(size_t)id] - 1;
+}
+
+std::string &HttpHeaders::operator[](const std::string &key) {
+    uint32_t hash = HashHeaderName(key.data(), key.size());
+    HttpHeaderId id = GetHttpHeaderId(key.data(), key.size(), hash);
+    size_t idx = indexOf(key.data(), key.size(), hash, id);
+    if(idx >= m_size) {
+        idx = append(key.data(), key.size(), hash, id);
+    }
+    return m_items[idx].second;
+}
+
+void HttpHeaders::set(const char *key, size_t klen, const char *val, size_t vlen) {
+    uint32_t hash = HashHeaderName(key, klen);
+    HttpHeaderId id = GetHttpHeaderId(key, klen, hash);
+    size_t idx = indexOf(key, klen, hash, id);
+    if(idx >= m_size) {
+        idx = append(key, klen, hash, id);
+    }
+    m_items[idx].second.assign(val, vlen);
+}
+
+size_t HttpHeaders::erase(const std::string &key) {
+    uint32_t hash = HashHeaderName(key.data(), key.size());
+    size_t idx = indexOf(key.data(), key.size(), hash, GetHttpHeaderId(key.data(), key.size(), hash));
+    if(idx >= m_size) {
+        return 0;
+    }
+    // 后面的往前挪一格，保持插入顺序
+    for(size_t i = idx + 1; i < m_size; ++i) {
+        m_items[i - 1] = std::move(m_items[i]);
+        m_hashes[i - 1] = m_hashes[i];
+    }
+    m_items[--m_size].~value_type();
+    for(size_t i = 0; i < KNOWN_COUNT; ++i) {
+        if(m_known[i] == idx + 1) {
+            m_known[i] = 0;
+        }
+        else if(m_known[i] > idx + 1) {
+            --m_known[i];
+        }
+    }
+    return 1;
+}
+
+size_t HttpHeaders::indexOf(const char *key, size_t len, uint32_t hash, HttpHeaderId id) const {
+    if(id != HttpHeaderId::UNKNOWN) {
+        return m_known[(size_t)id] ? m_known[(size_t)id] - 1 : m_size;
+    }
+    for(size_t i = 0; i < m_size; ++i) {
+        if(m_hashes[i] == hash && m_items[i].first.size() == len
+                && strncasecmp(m_items[i].first.data(), key, len) == 0) {
+            return i;
+        }
+    }
+    return m_size;
+}
+
+size_t HttpHeaders::append(const char *key, size_t len, uint32_t hash, HttpHeaderId id) {
+    if(m_size == m_capacity) {
+        reserve(m_capacity * 2);
+    }
+    new (m_items + m_size) value_type(std::string(key, len), std::string());
+    m_hashes[m_size] = hash;
+    if(id != HttpHeaderId::UNKNOWN) {
+        m_known[(size_t)id] = m_size + 1;
+    }
+    return m_size++;
+}
+
+void HttpHeaders::reserve(size_t capacity) {
+    if(capacity <= m_capacity) {
+        return;
+    }
+    value_type *items = (value_type *)::operator new(capacity * sizeof(value_type));
+    uint32_t *hashes = new uint32_t[capacity];
+    for(size_t i = 0; i < m_size; ++i) {
+        new (items + i) value_type(std::move(m_items[i]));
+        m_items[i].~value_type();
+        hashes[i] = m_hashes[i];
+    }
+    if(m_items != (value_type *)m_inlineItems) {
+        ::operator delete(m_items);
+        delete[] m_hashes;
+    }
+    m_items = items;
+    m_hashes = hashes;
+    m_capacity = capacity;
+}
+
+void HttpHeaders::destroy() {
+    clear();
+    if(m_items != (value_type *)m_inlineItems) {
+        ::operator delete(m_items);
+        delete[] m_hashes;
+        m_items = (value_type *)m_inlineItems;
+        m_hashes = m_inlineHashes;
+        m_capacity = INLINE_SIZE;
+    }
+}
+
+}
+
+}
@@ -1,4 +1,6 @@
 #include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include "http/http_parser.h"
 #include "log.h"
 #include "config.h"
@@ -98,16 +100,28 @@ void on_request_uri(void *data, const char *at, size_t length) {
 void on_request_fragment(void *data, const char *at, size_t length) {
     //AZURE_LOG_INFO(g_logger) << "on_request_fragment:" << std::string(at, length);
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
+    if(parser->isView()) {
+        parser->getData()->setRawFragment(StringView(at, length));
+        return;
+    }
     parser->getData()->setFragment(std::string(at, length));
 }
 
 void on_request_path(void *data, const char *at, size_t length) {
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
+    if(parser->isView()) {
+        parser->getData()->setRawPath(StringView(at, length));
+        return;
+    }
     parser->getData()->setPath(std::string(at, length));
 }
 
 void on_request_query(void *data, const char *at, size_t length) {
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
+    if(parser->isView()) {
+        parser->getData()->setRawQuery(StringView(at, length));
+        return;
+    }
     parser->getData()->setQuery(std::string(at, length));
 }
 
@@ -138,6 +152,10 @@ void on_request_http_field(void *data, const char *field, size_t flen, const cha
         //parser->setError(1002);
         return;
     }
+    if(parser->isView()) {
+        parser->getData()->addRawHeader(StringView(field, flen), StringView(value, vlen));
+        return;
+    }
     parser->getData()->setHeader(std::string(field, flen), std::string(value, vlen));
 }
 
@@ -156,8 +174,26 @@ HttpRequestParser::HttpRequestParser()
     m_parser.data = this;
 }
 
+void HttpRequestParser::reset(HttpRequest::ptr data) {
+    m_data = data;
+    m_error = 0;
+    m_view = false;
+    http_parser_init(&m_parser);
+}
+
 uint64_t HttpRequestParser::getContentLength() {
-    return m_data->getHeaderAs<uint64_t>("content-length", 0);
+    static const std::string CONTENT_LENGTH = "content-length";
+    // 直接在头部的片段上转换，不生成头部map
+    StringView val;
+    if(!m_data->getHeaderView(CONTENT_LENGTH, val) || val.empty() || val.size() > 20) {
+        return 0;
+    }
+    char buf[24];
+    memcpy(buf, val.data(), val.size());
+    buf[val.size()] = '\0';
+    char *end = nullptr;
+    uint64_t length = strtoull(buf, &end, 10);
+    return (*end || !isdigit(buf[0])) ? 0 : length;
 }
 
 //1: 成功
@@ -169,6 +205,11 @@ size_t HttpRequestParser::execute(char *data, size_t len) {
     return offset;
 }
 
+size_t HttpRequestParser::parseView(const char *data, size_t len) {
+    m_view = true;
+    return http_parser_execute(&m_parser, data, len, 0);
+}
+
 int HttpRequestParser::isFinished() {
     return http_parser_finish(&m_parser);
 }
@@ -239,15 +280,19 @@ HttpResponseParser::HttpResponseParser()
 }
 
 size_t HttpResponseParser::execute(char* data, size_t len, bool chunk) {
-    if(chunk) {
-        httpclient_parser_init(&m_parser);
-    }
-    size_t offset = httpclient_parser_execute(&m_parser, data, len, 0);
+    size_t offset = parse(data, len, chunk);
 
     memmove(data, data + offset, (len - offset));
     return offset;
 }
 
+size_t HttpResponseParser::parse(const char *data, size_t len, bool chunk) {
+    if(chunk) {
+        httpclient_parser_init(&m_parser);
+    }
+    return httpclient_parser_execute(&m_parser, data, len, 0);
+}
+
 int HttpResponseParser::isFinished() {
     return httpclient_parser_finish(&m_parser);
 }
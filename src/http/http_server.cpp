@@ -31,9 +31,22 @@ void HttpServer::handleClient(Socket::ptr client) {
         // AZURE_LOG_INFO(g_logger) << "request:" << std::endl << *req;
         // AZURE_LOG_INFO(g_logger) << "response:" << std::endl << *rsp;
 
-        session->sendResponse(rsp);
+        bool close = !m_isKeepalive || req->isClosed() || rsp->isClosed();
+        // servlet用startStream流式发送的，这里只补上结束块
+        if(session->getStreamWriter()) {
+            if(!session->endStream()) {
+                break;
+            }
+        }
+        else {
+            // 流水线上后面的请求已经读进来了，响应先攒着，处理完这一批一起发
+            // 发送失败（包括文件比content-length短）后连接上的数据已经对不上了，只能关闭
+            if(session->sendResponse(rsp, !close && session->hasBufferedRequest()) <= 0) {
+                break;
+            }
+        }
 
-        if(!m_isKeepalive || req->isClosed()) {
+        if(close) {
             break;
         }
     } while(m_isKeepalive);
@@ -1,94 +1,292 @@
+#include <algorithm>
 #include "http/http_session.h"
 #include "http/http_parser.h"
 #include "log.h"
 #include "macro.h"
+#include "config.h"
 
 namespace azure {
 
 static azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
 
+static azure::ConfigVar<uint32_t>::ptr g_http_response_stream_buffer_size =
+    azure::Config::Lookup<uint32_t>("http.response.stream_buffer_size", 16 * 1024, "streamed response bytes buffered before a chunk is sent");
+
 namespace http {
 
 HttpSession::HttpSession(Socket::ptr sock, bool owner)
-    : SocketStream(sock, owner) {
+    : BufferedSocketStream(sock, owner)
+    , m_parser(new HttpRequestParser) {
+}
+
+HttpSession::~HttpSession() {
+    // 请求还被别人拿着，缓冲区释放前把片段拷出去
+    if(m_request && m_request.use_count() > 1) {
+        m_request->detach();
+    }
+}
+
+// 找请求头结束的空行（\n 后面紧跟 \n 或 \r\n），从from开始找，返回头部长度，没找到返回0
+static size_t FindHeaderEnd(const char *data, size_t len, size_t from) {
+    for(size_t i = from; i < len; ++i) {
+        const char *p = (const char *)memchr(data + i, '\n', len - i);
+        if(!p) {
+            return 0;
+        }
+        i = p - data;
+        if(i + 1 < len && data[i + 1] == '\n') {
+            return i + 2;
+        }
+        if(i + 2 < len && data[i + 1] == '\r' && data[i + 2] == '\n') {
+            return i + 3;
+        }
+    }
+    return 0;
 }
 
 HttpRequest::ptr HttpSession::recvRequest() {
-    HttpRequestParser::ptr parser(new HttpRequestParser);
-    uint64_t buffer_size = HttpRequestParser::GetHttpRequestBufferSize();
-    // uint64_t buffer_size = 100;
-    std::shared_ptr<char> buffer(new char[buffer_size], [](char *ptr){delete[] ptr;});
-    char *data = buffer.get();
-    // memset(data, '\0', buffer_size);    // DEBUG 不加会出错
-    int offset = 0;
-
-    do {
-        int len = read(data + offset, buffer_size - offset);
-        if(len <= 0) {
-            // AZURE_LOG_INFO(g_logger) << " len=" << len;
+    // 上一个请求没人用了就连同已分配的容量一起复用，还被引用的先把片段拷出去再换新对象
+    if(m_request && m_request.use_count() == 1) {
+        m_request->reset();
+    }
+    else {
+        if(m_request) {
+            m_request->detach();
+        }
+        m_request.reset(new HttpRequest);
+    }
+    m_parser->reset(m_request);
+
+    // 上一个请求的数据到这里才丢掉，剩下的是后面流水线请求的开头
+    consume(m_requestEnd);
+    m_requestEnd = 0;
+
+    // 收齐整个请求头再解析一次，path/query/头部都直接指向读缓冲区
+    size_t max_header = HttpRequestParser::GetHttpRequestBufferSize();
+    size_t len = getReadSize();
+    size_t header_len = FindHeaderEnd(getReadData(), len, 0);
+    while(header_len == 0) {
+        if(len >= max_header) {
+            flushResponses();
             close();
             return nullptr;
         }
-        len += offset;
-        size_t nparse = parser->execute(data, len);
-        if(parser->hasError()) {
+        // 要挂起等数据了，先把攒着的响应发出去，否则对端可能在等响应
+        if(!m_pending.empty() && flushResponses() <= 0) {
             close();
             return nullptr;
         }
-        offset = len - nparse;
-        if(offset == (int)buffer_size) {
+        int rt = fill();
+        if(rt <= 0) {
             close();
             return nullptr;
         }
-        if(parser->isFinished()) {
-            break;
-        }
-    } while(true);
+        // 空行可能跨两次读，往回退两个字节接着找；fill可能挪过数据，指针要重新取
+        size_t from = len >= 2 ? len - 2 : 0;
+        len = getReadSize();
+        header_len = FindHeaderEnd(getReadData(), len, from);
+    }
 
-    // size_t s = strlen(data);
-    // AZURE_ASSERT2(data[s - 1] == '\n' && data[s - 2] == '\r', "request parser fail");
-    // AZURE_LOG_INFO(g_logger) << "data:" << std::endl << data;
+    const char *data = getReadData();
+    m_parser->parseView(data, header_len);
+    if(m_parser->hasError() || m_parser->isFinished() != 1) {
+        flushResponses();
+        close();
+        return nullptr;
+    }
 
-    int64_t length = parser->getContentLength();
+    int64_t offset = len - header_len;      // 和头部一起读进来的body（可能还有下一个请求）
+    int64_t length = m_parser->getContentLength();
+    int64_t copied = 0;
     if(length > 0) {
         std::string body;
         body.resize(length);
 
-        int len = 0;
-        if(length >= offset) {
-            memcpy(&body[0], data, offset);
-            len = offset;
-        }
-        else {
-            memcpy(&body[0], data, length);
-            len = length;
-        }
-        length -= offset;
-        if(length > 0) {
-            if(readFixSize(&body[len], length) <= 0) {
+        copied = std::min(length, offset);
+        memcpy(&body[0], data + header_len, copied);
+        if(length > copied) {
+            if(!m_pending.empty() && flushResponses() <= 0) {
                 close();
                 return nullptr;
             }
+            // 缓冲区里的数据都属于这个请求，剩下的body绕过缓冲区直接读，不会覆盖头部的片段
+            for(int64_t left = length - copied; left > 0;) {
+                int rt = SocketStream::read(&body[length - left], left);
+                if(rt <= 0) {
+                    close();
+                    return nullptr;
+                }
+                left -= rt;
+            }
         }
-        parser->getData()->setBody(body);
+        m_request->setBody(body);
     }
+    m_requestEnd = header_len + copied;
 
-    // DEBUG 这里可能因为大小写出问题
-    std::string keep_alive = parser->getData()->getHeader("Connection");
-    if(strcasecmp(keep_alive.c_str(), "keep-alive") == 0) {
-        parser->getData()->setClose(false);
+    StringView keep_alive;
+    if(m_request->getHeaderView("Connection", keep_alive) && keep_alive.equalsIgnoreCase("keep-alive")) {
+        m_request->setClose(false);
     }
 
-    return parser->getData();
+    return m_request;
 }
 
-int HttpSession::sendResponse(HttpResponse::ptr rsp) {
-    std::stringstream ss;
-    ss << *rsp;
-    std::string data = ss.str();
-    return writeFixSize(data.c_str(), data.size());
+int HttpSession::sendResponse(HttpResponse::ptr rsp, bool more) {
+    if(rsp->getFileBody()) {
+        // 文件body不能放进writev，和前面攒着的一起先把头部发掉
+        rsp->appendHeader(m_outBuf);
+        m_pendingHeaderEnds.push_back(m_outBuf.size());
+        m_pending.push_back(nullptr);
+        int header_len = flushResponses();
+        if(header_len <= 0 || rsp->getFileLength() == 0) {
+            return header_len;
+        }
+        int rt = sendFileFixSize(rsp->getFileBody()->getFd(), rsp->getFileOffset(), rsp->getFileLength());
+        return rt < 0 ? rt : header_len;
+    }
+
+    rsp->appendHeader(m_outBuf);
+    m_pendingHeaderEnds.push_back(m_outBuf.size());
+    m_pending.push_back(rsp);
+    if(more && m_pending.size() < MAX_PENDING_RESPONSES) {
+        return m_outBuf.size();
+    }
+    return flushResponses();
 }
 
+int HttpSession::flushResponses() {
+    if(m_pending.empty()) {
+        return 0;
+    }
+    // 头部都在m_outBuf里，body直接引用各自的响应，不拷贝
+    m_iovs.clear();
+    size_t begin = 0;
+    for(size_t i = 0; i < m_pending.size(); ++i) {
+        iovec iov;
+        iov.iov_base = &m_outBuf[begin];
+        iov.iov_len = m_pendingHeaderEnds[i] - begin;
+        m_iovs.push_back(iov);
+        begin = m_pendingHeaderEnds[i];
+        if(m_pending[i] && !m_pending[i]->getBody().empty()) {
+            const std::string &body = m_pending[i]->getBody();
+            iov.iov_base = (void *)body.data();
+            iov.iov_len = body.size();
+            m_iovs.push_back(iov);
+        }
+    }
+    int rt = writevFixSize(&m_iovs[0], m_iovs.size());
+    m_outBuf.clear();
+    m_pending.clear();
+    m_pendingHeaderEnds.clear();
+    return rt;
 }
 
-}
\ No newline at end of file
+HttpResponseWriter::ptr HttpSession::startStream(HttpResponse::ptr rsp) {
+    AZURE_ASSERT(!m_writer);
+    // 流水线上前面的响应要先发出去
+    flushResponses();
+    m_writer.reset(new HttpResponseWriter(this, rsp));
+    return m_writer;
+}
+
+bool HttpSession::endStream() {
+    if(!m_writer) {
+        return true;
+    }
+    m_writer->finish();
+    bool ok = !m_writer->hasError();
+    m_writer.reset();
+    return ok;
+}
+
+HttpResponseWriter::HttpResponseWriter(HttpSession *session, HttpResponse::ptr rsp)
+    : m_session(session)
+    , m_rsp(rsp)
+    , m_chunked(rsp->getVersion() >= 0x11)
+    , m_bufferSize(g_http_response_stream_buffer_size->getValue()) {
+    m_rsp->delHeader("content-length");
+    if(m_chunked) {
+        m_rsp->setHeader("Transfer-Encoding", "chunked");
+    }
+    else {
+        // 没有长度也没有分块，只能靠关闭连接表示body结束
+        m_rsp->setClose(true);
+    }
+}
+
+int HttpResponseWriter::write(const void *buffer, size_t length) {
+    if(m_finished || m_error) {
+        return -1;
+    }
+    if(m_buffer.size() + length <= m_bufferSize) {
+        m_buffer.append((const char *)buffer, length);
+        return length;
+    }
+    // 缓冲区放不下，和已有数据合成一块直接发，大块数据不拷贝
+    int rt = sendChunk(buffer, length, false);
+    return rt < 0 ? rt : length;
+}
+
+int HttpResponseWriter::flush() {
+    if(m_finished || m_error) {
+        return -1;
+    }
+    return sendChunk(nullptr, 0, false);
+}
+
+int HttpResponseWriter::finish() {
+    if(m_finished || m_error) {
+        return m_error ? -1 : 0;
+    }
+    int rt = sendChunk(nullptr, 0, true);
+    m_finished = true;
+    return rt;
+}
+
+int HttpResponseWriter::sendChunk(const void *data, size_t length, bool last) {
+    iovec iovs[6];
+    size_t cnt = 0;
+    if(!m_headerSent) {
+        m_rsp->dumpHeader(m_session->m_headerBuf);
+        iovs[cnt].iov_base = (void *)m_session->m_headerBuf.data();
+        iovs[cnt++].iov_len = m_session->m_headerBuf.size();
+    }
+
+    size_t size = m_buffer.size() + length;
+    char line[24];
+    if(size > 0) {
+        if(m_chunked) {
+            iovs[cnt].iov_base = line;
+            iovs[cnt++].iov_len = snprintf(line, sizeof(line), "%zx\r\n", size);
+        }
+        iovs[cnt].iov_base = (void *)m_buffer.data();
+        iovs[cnt++].iov_len = m_buffer.size();
+        iovs[cnt].iov_base = (void *)data;
+        iovs[cnt++].iov_len = length;
+        if(m_chunked) {
+            iovs[cnt].iov_base = (void *)"\r\n";
+            iovs[cnt++].iov_len = 2;
+        }
+    }
+    if(last && m_chunked) {
+        iovs[cnt].iov_base = (void *)"0\r\n\r\n";
+        iovs[cnt++].iov_len = 5;
+    }
+    if(cnt == 0) {
+        return 0;
+    }
+
+    int rt = m_session->writevFixSize(iovs, cnt);
+    if(rt <= 0) {
+        m_error = true;
+        return -1;
+    }
+    m_headerSent = true;
+    m_bodySize += size;
+    m_buffer.clear();
+    return rt;
+}
+
+}
+
+}
@@ -0,0 +1,350 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ctype.h>
+#include <algorithm>
+#include "http/static_file_servlet.h"
+#include "config.h"
+#include "util.h"
+#include "log.h"
+
+namespace azure {
+
+namespace http {
+
+static azure::Logger::ptr g_logger = AZURE_LOG_NAME("system");
+
+static ConfigVar<uint64_t>::ptr g_static_file_cache_ttl = Config::Lookup("http.static_file.cache_ttl", (uint64_t)1000, "static file fd/stat cache ttl in ms");
+static ConfigVar<uint32_t>::ptr g_static_file_cache_max = Config::Lookup<uint32_t>("http.static_file.cache_max", 1024, "max opened files kept by static file cache");
+
+// RFC 7231 的 IMF-fixdate，例如 Sun, 06 Nov 1994 08:49:37 GMT
+static const char *HTTP_DATE_FORMAT = "%a, %d %b %Y %H:%M:%S GMT";
+
+static std::string FormatHttpDate(time_t ts) {
+    struct tm tm;
+    gmtime_r(&ts, &tm);
+    char buf[64];
+    strftime(buf, sizeof(buf), HTTP_DATE_FORMAT, &tm);
+    return buf;
+}
+
+static bool ParseHttpDate(const std::string &str, time_t &ts) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(str.c_str(), HTTP_DATE_FORMAT, &tm);
+    if(!end || *end) {
+        return false;
+    }
+    ts = timegm(&tm);
+    return true;
+}
+
+static const char *GetContentType(const std::string &path) {
+    static const std::unordered_map<std::string, const char*> s_types = {
+        {"html", "text/html"},
+        {"htm", "text/html"},
+        {"css", "text/css"},
+        {"js", "application/javascript"},
+        {"json", "application/json"},
+        {"txt", "text/plain"},
+        {"xml", "text/xml"},
+        {"png", "image/png"},
+        {"jpg", "image/jpeg"},
+        {"jpeg", "image/jpeg"},
+        {"gif", "image/gif"},
+        {"svg", "image/svg+xml"},
+        {"ico", "image/x-icon"},
+        {"webp", "image/webp"},
+        {"wasm", "application/wasm"},
+        {"pdf", "application/pdf"},
+        {"mp4", "video/mp4"},
+    };
+    size_t pos = path.rfind('.');
+    if(pos != std::string::npos && path.find('/', pos) == std::string::npos) {
+        std::string ext = path.substr(pos + 1);
+        for(auto &c : ext) {
+            c = tolower(c);
+        }
+        auto it = s_types.find(ext);
+        if(it != s_types.end()) {
+            return it->second;
+        }
+    }
+    return "application/octet-stream";
+}
+
+// 路径里有 .. 段就可能跳出root
+static bool IsSafePath(const std::string &path) {
+    size_t pos = 0;
+    while(pos < path.size()) {
+        size_t next = path.find('/', pos);
+        if(next == std::string::npos) {
+            next = path.size();
+        }
+        if(next - pos == 2 && path.compare(pos, 2, "..") == 0) {
+            return false;
+        }
+        pos = next + 1;
+    }
+    return path.find('\0') == std::string::npos;
+}
+
+// If-None-Match 可以是 * 或者逗号分隔的多个etag，弱比较
+static bool MatchEtag(const std::string &header, const std::string &etag) {
+    if(header == "*") {
+        return true;
+    }
+    size_t pos = 0;
+    while(pos < header.size()) {
+        size_t next = header.find(',', pos);
+        if(next == std::string::npos) {
+            next = header.size();
+        }
+        size_t b = header.find_first_not_of(" \t", pos);
+        size_t e = header.find_last_not_of(" \t", next - 1);
+        if(b != std::string::npos && b < next && e >= b) {
+            if(header.compare(b, 2, "W/") == 0) {
+                b += 2;
+            }
+            if(header.compare(b, e - b + 1, etag) == 0) {
+                return true;
+            }
+        }
+        pos = next + 1;
+    }
+    return false;
+}
+
+// 只处理单个区间 bytes=a-b / bytes=a- / bytes=-n
+// 返回1表示区间有效，0表示不认识或者多个区间（按整个文件返回），-1表示区间不可满足
+static int ParseRange(const std::string &range, uint64_t size, uint64_t &begin, uint64_t &end) {
+    if(strncasecmp(range.c_str(), "bytes=", 6) != 0 || range.find(',') != std::string::npos) {
+        return 0;
+    }
+    const char *p = range.c_str() + 6;
+    char *e = nullptr;
+    if(*p == '-') {
+        if(!isdigit(p[1])) {
+            return 0;
+        }
+        uint64_t suffix = strtoull(p + 1, &e, 10);
+        if(*e) {
+            return 0;
+        }
+        if(suffix == 0 || size == 0) {
+            return -1;
+        }
+        begin = size > suffix ? size - suffix : 0;
+        end = size - 1;
+        return 1;
+    }
+    if(!isdigit(*p)) {
+        return 0;
+    }
+    begin = strtoull(p, &e, 10);
+    if(*e != '-') {
+        return 0;
+    }
+    p = e + 1;
+    end = -1;
+    if(*p) {
+        if(!isdigit(*p)) {
+            return 0;
+        }
+        end = strtoull(p, &e, 10);
+        if(*e || end < begin) {
+            return 0;
+        }
+    }
+    if(begin >= size) {
+        return -1;
+    }
+    end = std::min(end, size - 1);
+    return 1;
+}
+
+StaticFileServlet::StaticFileServlet(const std::string &root, const std::string &prefix)
+    : Servlet("StaticFileServlet")
+    , m_root(root)
+    , m_prefix(prefix)
+    , m_cacheTtl(g_static_file_cache_ttl->getValue())
+    , m_cacheMax(g_static_file_cache_max->getValue()) {
+    while(m_root.size() > 1 && m_root.back() == '/') {
+        m_root.pop_back();
+    }
+    m_notFound.reset(new NotFoundServlet);
+}
+
+int32_t StaticFileServlet::handle(azure::http::HttpRequest::ptr request, azure::http::HttpResponse::ptr response,
+                                  azure::http::HttpSession::ptr session) {
+    HttpMethod method = request->getMethod();
+    if(method != HttpMethod::GET && method != HttpMethod::HEAD) {
+        response->setStatus(HttpStatus::METHOD_NOT_ALLOWED);
+        response->setHeader("Allow", "GET, HEAD");
+        return 0;
+    }
+
+    const std::string &uri = request->getPath();
+    if(uri.compare(0, m_prefix.size(), m_prefix) != 0) {
+        return m_notFound->handle(request, response, session);
+    }
+    std::string rel = uri.substr(m_prefix.size());
+    if(rel.empty() || rel[0] != '/') {
+        rel = "/" + rel;
+    }
+    if(rel.back() == '/') {
+        rel += "index.html";
+    }
+    if(!IsSafePath(rel)) {
+        return m_notFound->handle(request, response, session);
+    }
+
+    FileInfo::ptr info = getFile(m_root + rel);
+    if(!info) {
+        return m_notFound->handle(request, response, session);
+    }
+
+    response->setHeader("ETag", info->etag);
+    response->setHeader("Last-Modified", info->lastModified);
+    response->setHeader("Accept-Ranges", "bytes");
+
+    // If-None-Match 优先，有它就不看 If-Modified-Since
+    std::string inm = request->getHeader("If-None-Match");
+    if(!inm.empty()) {
+        if(MatchEtag(inm, info->etag)) {
+            response->setStatus(HttpStatus::NOT_MODIFIED);
+            return 0;
+        }
+    }
+    else {
+        time_t since = 0;
+        std::string ims = request->getHeader("If-Modified-Since");
+        if(!ims.empty() && ParseHttpDate(ims, since) && info->mtime.tv_sec <= since) {
+            response->setStatus(HttpStatus::NOT_MODIFIED);
+            return 0;
+        }
+    }
+
+    response->setHeader("Content-Type", GetContentType(rel));
+    uint64_t offset = 0;
+    uint64_t length = info->size;
+    std::string range = request->getHeader("Range");
+    std::string if_range = request->getHeader("If-Range");
+    // If-Range 对不上说明客户端手里的是旧版本，返回整个文件
+    if(!range.empty() && (if_range.empty() || if_range == info->etag || if_range == info->lastModified)) {
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        int rt = ParseRange(range, info->size, begin, end);
+        if(rt < 0) {
+            response->setStatus(HttpStatus::RANGE_NOT_SATISFIABLE);
+            response->setHeader("Content-Range", "bytes */" + std::to_string(info->size));
+            response->setHeader("content-length", "0");
+            return 0;
+        }
+        if(rt > 0) {
+            response->setStatus(HttpStatus::PARTIAL_CONTENT);
+            response->setHeader("Content-Range", "bytes " + std::to_string(begin) + "-"
+                                + std::to_string(end) + "/" + std::to_string(info->size));
+            offset = begin;
+            length = end - begin + 1;
+        }
+    }
+
+    if(method == HttpMethod::HEAD) {
+        response->setHeader("content-length", std::to_string(length));
+        return 0;
+    }
+    response->setFileBody(info->file, offset, length);
+    return 0;
+}
+
+void StaticFileServlet::clearCache() {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_cache.clear();
+}
+
+StaticFileServlet::FileInfo::ptr StaticFileServlet::getFile(const std::string &path) {
+    uint64_t now = azure::GetCurrentMS();
+    FileInfo::ptr old;
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        auto it = m_cache.find(path);
+        if(it != m_cache.end()) {
+            if(it->second->expire > now) {
+                return it->second;
+            }
+            old = it->second;
+        }
+    }
+
+    // stat/open不持锁，并发的miss可能各自打开一次，以后写入的为准
+    FileInfo::ptr info = loadFile(path, old, now);
+    RWMutexType::WriteLock lock(m_mutex);
+    if(!info) {
+        m_cache.erase(path);
+        return nullptr;
+    }
+    if(m_cache.size() >= m_cacheMax && !m_cache.count(path)) {
+        for(auto it = m_cache.begin(); it != m_cache.end();) {
+            if(it->second->expire <= now) {
+                it = m_cache.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        // 都没过期就整个清掉，被引用的fd等发送完再关
+        if(m_cache.size() >= m_cacheMax) {
+            m_cache.clear();
+        }
+    }
+    m_cache[path] = info;
+    return info;
+}
+
+StaticFileServlet::FileInfo::ptr StaticFileServlet::loadFile(const std::string &path, FileInfo::ptr old, uint64_t now) {
+    struct stat st;
+    if(old) {
+        if(stat(path.c_str(), &st) != 0) {
+            return nullptr;
+        }
+        if(st.st_dev == old->dev && st.st_ino == old->ino && (uint64_t)st.st_size == old->size
+                && st.st_mtim.tv_sec == old->mtime.tv_sec && st.st_mtim.tv_nsec == old->mtime.tv_nsec) {
+            // 缓存项是共享的，不原地修改，复制一份换掉
+            FileInfo::ptr info(new FileInfo(*old));
+            info->expire = now + m_cacheTtl;
+            return info;
+        }
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return nullptr;
+    }
+    FileBody::ptr file(new FileBody(fd));
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return nullptr;
+    }
+
+    FileInfo::ptr info(new FileInfo);
+    info->file = file;
+    info->dev = st.st_dev;
+    info->ino = st.st_ino;
+    info->size = st.st_size;
+    info->mtime = st.st_mtim;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\"%lx-%lx-%lx\"", (unsigned long)st.st_mtim.tv_sec,
+             (unsigned long)st.st_mtim.tv_nsec, (unsigned long)st.st_size);
+    info->etag = buf;
+    info->lastModified = FormatHttpDate(st.st_mtim.tv_sec);
+    info->expire = now + m_cacheTtl;
+    AZURE_LOG_DEBUG(g_logger) << "static file open path=" << path << " fd=" << fd << " size=" << info->size;
+    return info;
+}
+
+}
+
+}
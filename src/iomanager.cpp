@@ -1,16 +1,44 @@
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <algorithm>
 #include "iomanager.h"
 #include "macro.h"
 #include "log.h"
+#include "config.h"
+#include "fdmanager.h"
 
 namespace azure {
 
 static azure::Logger::ptr g_logger = AZURE_LOG_NAME("system");
 
+// 每个调度线程一个epoll，fd的事件只在持有它的线程上处理
+static ConfigVar<bool>::ptr g_iomanager_multi_reactor = Config::Lookup<bool>("iomanager.multi_reactor", false, "one epoll per worker thread");
+// fd只注册一次读写边缘触发，事件触发后不再epoll_ctl修改/删除
+static ConfigVar<bool>::ptr g_iomanager_persistent_events = Config::Lookup<bool>("iomanager.persistent_events", false, "register fds once with edge-triggered read and write interest");
+// socket的IO交给io_uring执行，内核不支持时退回epoll
+static ConfigVar<bool>::ptr g_iomanager_io_uring = Config::Lookup<bool>("iomanager.io_uring", false, "use io_uring for socket io");
+static ConfigVar<uint32_t>::ptr g_iomanager_io_uring_entries = Config::Lookup<uint32_t>("iomanager.io_uring_entries", 256, "io_uring submission queue size");
+// 一次epoll_wait最多取回的事件数
+static ConfigVar<uint32_t>::ptr g_iomanager_epoll_events = Config::Lookup<uint32_t>("iomanager.epoll_events", 256, "max events returned by one epoll_wait");
+// idle阻塞前最多自旋轮询多少微秒，0为不自旋
+static ConfigVar<uint32_t>::ptr g_iomanager_spin_us = Config::Lookup<uint32_t>("iomanager.spin_us", 0, "max busy-poll time in microseconds before blocking in epoll_wait");
+
+// 本线程攒够这么多sqe就立刻提交，否则等到idle里一次提交
+static const uint32_t URING_SUBMIT_BATCH = 32;
+
+// 挂起在io_uring操作上的协程，放在协程自己的栈上，user_data指向它
+struct IOManager::UringWaiter {
+    Scheduler *scheduler = nullptr;
+    Fiber::ptr fiber;
+    FdContext *fdCtx = nullptr;
+    int res = 0;
+};
+
 IOManager::FdContext::EventContext &IOManager::FdContext::getContext(IOManager::Event event) {
     switch(event) {
         case IOManager::READ:
@@ -28,11 +56,19 @@ void IOManager::FdContext::resetContext(IOManager::FdContext::EventContext &ctx)
     ctx.cb = nullptr;
 }
 
-void IOManager::FdContext::triggerEvent(IOManager::Event event) {
+void IOManager::FdContext::triggerEvent(IOManager::Event event, IOManager *iom) {
     AZURE_ASSERT(events & event);
     events = (Event)(events & ~event);
     EventContext &ctx = getContext(event);
-    if(ctx.cb) {
+    if(iom && ctx.scheduler == iom) {
+        if(ctx.cb) {
+            iom->batchSchedule(&ctx.cb);
+        }
+        else {
+            iom->batchSchedule(&ctx.fiber);
+        }
+    }
+    else if(ctx.cb) {
         ctx.scheduler->schedule(&ctx.cb);
     }
     else {
@@ -41,68 +77,87 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     ctx.scheduler = nullptr;
 }
 
-// 使用信号量会阻塞线程，无法实现异步IO
-IOManager::IOManager(size_t thread_num, bool use_caller, const std::string &name) 
-    : Scheduler(thread_num, use_caller, name) {
-    m_epollfd = epoll_create(5000);
-    AZURE_ASSERT(m_epollfd > 0);
+IOManager::Poller::Poller() {
+    epfd = epoll_create(5000);
+    AZURE_ASSERT(epfd > 0);
 
-    int rt = pipe(m_tickleFds);         // rt, return
-    AZURE_ASSERT(!rt);
+    // eventfd 只有一个8字节计数器，多次写入只需要一次read就能清空
+    tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    AZURE_ASSERT(tickleFd >= 0);
 
     epoll_event event;
     memset(&event, 0, sizeof(event));
     event.events = EPOLLIN | EPOLLET;   // 读事件，边缘触发
-    event.data.fd = m_tickleFds[0];     // 0读1写
+    event.data.fd = tickleFd;
 
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
+    int rt = epoll_ctl(epfd, EPOLL_CTL_ADD, tickleFd, &event);  // 注册eventfd读事件
     AZURE_ASSERT(!rt);
+}
 
-    rt = epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);   // 注册管道读事件
-    AZURE_ASSERT(!rt);
-
-    contextResize(32);                  // 默认大小32
-
-    start();                            // 默认启动
+IOManager::Poller::~Poller() {
+    close(epfd);
+    close(tickleFd);
 }
 
-IOManager::~IOManager() {
-    stop();
-    close(m_epollfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
+// 使用信号量会阻塞线程，无法实现异步IO
+IOManager::IOManager(size_t thread_num, bool use_caller, const std::string &name, const AffinityPolicy &affinity) 
+    : Scheduler(thread_num, use_caller, name, affinity) {
+    m_multiReactor = g_iomanager_multi_reactor->getValue();
+    m_persistent = g_iomanager_persistent_events->getValue();
+    m_spinUs = g_iomanager_spin_us->getValue();
+
+    // 完成队列只能由一个线程收割，所以每个调度线程一个io_uring，任何一个创建失败都退回epoll
+    std::vector<Uring::ptr> rings;
+    if(g_iomanager_io_uring->getValue()) {
+        for(size_t i = 0; i < getProcessorCount(); ++i) {
+            Uring::ptr ring = Uring::Create(g_iomanager_io_uring_entries->getValue());
+            if(!ring) {
+                AZURE_LOG_WARN(g_logger) << "io_uring unavailable, fall back to epoll";
+                rings.clear();
+                break;
+            }
+            rings.push_back(ring);
+        }
+        if(!rings.empty()) {
+            m_useUring = true;
+            m_multiReactor = true;
+        }
+    }
 
-    for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if(m_fdContexts[i]) {
-            delete m_fdContexts[i];
+    size_t pollers = m_multiReactor ? getProcessorCount() : 1;
+    for(size_t i = 0; i < pollers; ++i) {
+        Poller *poller = new Poller;
+        if(m_useUring) {
+            // 有完成事件时io_uring的fd可读，和其他事件一起在epoll_wait里等待
+            poller->uring = rings[i];
+            epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN | EPOLLET;
+            event.data.fd = poller->uring->getFd();
+            int rt = epoll_ctl(poller->epfd, EPOLL_CTL_ADD, poller->uring->getFd(), &event);
+            AZURE_ASSERT(!rt);
         }
+        m_pollers.push_back(poller);
     }
-}
 
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size);
+    initTimerShards(getProcessorCount());   // 每个调度线程一个定时器分片
 
-    for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if(!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;    // 自己指定文件描述符？
-        }
+    start();                            // 默认启动
+}
+
+IOManager::~IOManager() {
+    stop();
+    for(auto &i : m_pollers) {
+        delete i;
     }
 }
 
 // 0 success, -1 error
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-    FdContext *fd_ctx = nullptr;
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    }
-    else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+    FdContext *fd_ctx = m_fdContexts.get(fd, true);
+    if(!fd_ctx) {
+        AZURE_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
+        return -1;
     }
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
@@ -111,17 +166,56 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         AZURE_ASSERT(!(fd_ctx->events &event));
     }
 
-    // 已有注册事件就修改（EPOLL_CTL_MOD），否则就加（EPOLL_CTL_ADD）
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epollfd, op, fd, &epevent);    // 向 epoll_table 注册 fd_ctx 上的事件
-    if(rt) {
-        AZURE_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epollfd << ", " << op << ", " << fd << ", " << epevent.events
-                                    << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return -1;
+    Poller *poller = ownerPoller(fd_ctx);
+    if(m_persistent) {
+        // fd在别的IOManager的线程上关闭时这里的cancelAll不会执行，registered还留着；
+        // 内核在关闭时已经把它移出了epoll，同号的新fd要重新注册，旧的就绪边缘也作废
+        FdCtx *ctx = FdMgr::GetInstance()->get(fd);
+        uint32_t generation = ctx ? ctx->getGeneration() : 0;
+        if(fd_ctx->registered && fd_ctx->generation != generation) {
+            fd_ctx->registered = false;
+            fd_ctx->ready = NONE;
+        }
+        // 上次触发的边缘还没有被消费，不用等待
+        if(fd_ctx->ready & event) {
+            fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+            if(!cb) {
+                return 1;
+            }
+            Scheduler::GetThis()->schedule(&cb);
+            return 0;
+        }
+        if(!fd_ctx->registered) {
+            epoll_event epevent;
+            epevent.events = EPOLLET | EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+            epevent.data.ptr = fd_ctx;
+            int rt = epoll_ctl(poller->epfd, EPOLL_CTL_ADD, fd, &epevent);
+            // 没经过hook的fd判断不了复用，已经在epoll里就当注册成功
+            if(rt && errno == EEXIST) {
+                rt = epoll_ctl(poller->epfd, EPOLL_CTL_MOD, fd, &epevent);
+            }
+            if(rt) {
+                AZURE_LOG_ERROR(g_logger) << "epoll_ctl(" << poller->epfd << ", " << EPOLL_CTL_ADD << ", " << fd << ", " << epevent.events
+                                            << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                return -1;
+            }
+            fd_ctx->registered = true;
+            fd_ctx->generation = generation;
+        }
+    }
+    else {
+        // 已有注册事件就修改（EPOLL_CTL_MOD），否则就加（EPOLL_CTL_ADD）
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events = EPOLLET | fd_ctx->events | event;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(poller->epfd, op, fd, &epevent);     // 向 epoll_table 注册 fd_ctx 上的事件
+        if(rt) {
+            AZURE_LOG_ERROR(g_logger) << "epoll_ctl(" << poller->epfd << ", " << op << ", " << fd << ", " << epevent.events
+                                        << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return -1;
+        }
     }
 
     ++m_pendingEventCount;
@@ -147,12 +241,10 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
 }
 
 bool IOManager::delEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if(!(fd_ctx->events & event)) {
@@ -160,15 +252,7 @@ bool IOManager::delEvent(int fd, Event event) {
     }
 
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epollfd, op, fd, &epevent);
-    if(rt) {
-        AZURE_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epollfd << ", " << op << ", " << fd << ", " << epevent.events
-                                    << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
+    if(!m_persistent && !updateInterest(fd_ctx, new_events)) {
         return false;
     }
 
@@ -181,12 +265,10 @@ bool IOManager::delEvent(int fd, Event event) {
 
 // 强制触发执行
 bool IOManager::cancelEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if(!(fd_ctx->events & event)) {
@@ -194,15 +276,7 @@ bool IOManager::cancelEvent(int fd, Event event) {
     }
 
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epollfd, op, fd, &epevent);
-    if(rt) {
-        AZURE_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epollfd << ", " << op << ", " << fd << ", " << epevent.events
-                                    << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
+    if(!m_persistent && !updateInterest(fd_ctx, new_events)) {
         return false;
     }
 
@@ -213,15 +287,23 @@ bool IOManager::cancelEvent(int fd, Event event) {
 }
 
 bool IOManager::cancelAll(int fd) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if(!fd_ctx->events) {
+    // 一般是fd要关闭了，之后同一个fd号重新分配所属的epoll
+    Poller *poller = fd_ctx->poller >= 0 ? m_pollers[fd_ctx->poller] : nullptr;
+    fd_ctx->poller = -1;
+    if(poller && poller->uring && fd_ctx->uringOps > 0) {
+        cancelUring(poller, fd);
+    }
+    bool registered = m_persistent ? fd_ctx->registered : fd_ctx->events != NONE;
+    fd_ctx->registered = false;
+    fd_ctx->ready = NONE;
+    if(!registered) {
+        AZURE_ASSERT(fd_ctx->events == 0);
         return false;
     }
 
@@ -230,11 +312,13 @@ bool IOManager::cancelAll(int fd) {
     epevent.events = 0;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epollfd, op, fd, &epevent);
+    int rt = epoll_ctl(poller->epfd, op, fd, &epevent);
     if(rt) {
-        AZURE_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epollfd << ", " << op << ", " << fd << ", " << epevent.events
+        AZURE_LOG_ERROR(g_logger) << "epoll_ctl(" << poller->epfd << ", " << op << ", " << fd << ", " << epevent.events
                                     << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+        if(!m_persistent) {
+            return false;
+        }
     }
 
     if(fd_ctx->events & READ) {
@@ -250,21 +334,312 @@ bool IOManager::cancelAll(int fd) {
     return true;
 }
 
+// 非持久注册模式下，把fd在epoll里关注的事件改成events，调用时持有fd_ctx->mutex
+bool IOManager::updateInterest(FdContext *fd_ctx, Event events) {
+    int op = events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    epoll_event epevent;
+    epevent.events = EPOLLET | events;
+    epevent.data.ptr = fd_ctx;
+
+    Poller *poller = ownerPoller(fd_ctx);
+    int rt = epoll_ctl(poller->epfd, op, fd_ctx->fd, &epevent);
+    if(rt) {
+        AZURE_LOG_ERROR(g_logger) << "epoll_ctl(" << poller->epfd << ", " << op << ", " << fd_ctx->fd << ", " << epevent.events
+                                    << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
+        return false;
+    }
+    return true;
+}
+
+int IOManager::uringIO(int fd, const UringOp &op, uint64_t timeout_ms) {
+#ifdef AZURE_HAVE_IO_URING
+    if(!m_useUring) {
+        return -EAGAIN;
+    }
+    FdContext *fd_ctx = m_fdContexts.get(fd, true);
+    if(!fd_ctx) {
+        return -EBADF;
+    }
+    int index = -1;
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        ownerPoller(fd_ctx);
+        index = fd_ctx->poller;
+    }
+    Poller *poller = m_pollers[index];
+    Uring *ring = poller->uring.get();
+
+    UringWaiter waiter;
+    waiter.scheduler = Scheduler::GetThis();
+    waiter.fiber = Fiber::GetThis();
+    waiter.fdCtx = fd_ctx;
+
+    // 链接的超时在提交时才被内核读取，提交前协程一直挂起，放在栈上就可以
+    __kernel_timespec ts;
+    bool has_timeout = timeout_ms != ~0ull;
+    bool need_wake = false;
+    {
+        Uring::MutexType::Lock lock(ring->getMutex());
+        io_uring_sqe *sqe = ring->getSqe();
+        io_uring_sqe *timeout_sqe = nullptr;
+        if(sqe && has_timeout) {
+            timeout_sqe = ring->getSqe();
+            if(!timeout_sqe) {
+                // 链接的两个sqe必须在同一次提交里，撤销刚取到的sqe
+                sqe->opcode = IORING_OP_NOP;
+                sqe->user_data = 0;
+                sqe = nullptr;
+            }
+        }
+        if(!sqe) {
+            return -EAGAIN;
+        }
+
+        sqe->opcode = op.opcode;
+        sqe->fd = fd;
+        sqe->addr = op.addr;
+        sqe->len = op.len;
+        sqe->msg_flags = op.msg_flags;
+        sqe->addr2 = op.addr2;
+        sqe->user_data = (uint64_t)&waiter;
+        if(timeout_sqe) {
+            sqe->flags |= IOSQE_IO_LINK;
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000 * 1000;
+            timeout_sqe->opcode = IORING_OP_LINK_TIMEOUT;
+            timeout_sqe->fd = -1;
+            timeout_sqe->addr = (uint64_t)&ts;
+            timeout_sqe->len = 1;
+            timeout_sqe->user_data = 0;
+        }
+
+        ++fd_ctx->uringOps;
+        ++m_pendingEventCount;
+        // 本线程的io_uring攒到idle里批量提交；其他线程的要立刻提交，它可能正阻塞在epoll_wait上
+        bool local = index == getProcessorIndex();
+        if(!local || ring->pending() >= URING_SUBMIT_BATCH) {
+            ring->submit();
+        }
+        // 内核暂时不接收，交给所属线程的idle重试
+        need_wake = !local && ring->pending() > 0;
+    }
+    if(need_wake) {
+        wakePoller(poller);
+    }
+
+    Fiber::YieldToHold();
+    return waiter.res;
+#else
+    return -EAGAIN;
+#endif
+}
+
+// 只在fd所属线程的idle里调用，返回唤醒的协程数，由调用方扣减m_pendingEventCount
+size_t IOManager::reapUring(Poller *poller) {
+    size_t count = 0;
+    poller->uring->reap([this, &count](uint64_t user_data, int res) {
+        // 链接的超时和取消操作不关心结果
+        if(!user_data) {
+            return;
+        }
+        UringWaiter *waiter = (UringWaiter*)user_data;
+        waiter->res = res;
+        --waiter->fdCtx->uringOps;
+        ++count;
+        // 协程被调度之后栈上的waiter随时会失效，先把需要的东西取出来
+        Scheduler *scheduler = waiter->scheduler;
+        Fiber::ptr fiber;
+        fiber.swap(waiter->fiber);
+        if(scheduler == this) {
+            batchSchedule(&fiber);
+        }
+        else {
+            scheduler->schedule(&fiber);
+        }
+    });
+    return count;
+}
+
+// fd要关闭了，取消它上面还没完成的io_uring操作，调用时持有fd_ctx->mutex
+void IOManager::cancelUring(Poller *poller, int fd) {
+#ifdef AZURE_HAVE_IO_URING
+#ifdef IORING_ASYNC_CANCEL_FD
+    {
+        Uring *ring = poller->uring.get();
+        Uring::MutexType::Lock lock(ring->getMutex());
+        io_uring_sqe *sqe = ring->getSqe();
+        if(sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = fd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = 0;
+            // 内核按fd查找文件，必须在close之前提交
+            if(ring->submit() >= 0) {
+                return;
+            }
+        }
+    }
+#endif
+    // 老内核不支持按fd取消，shutdown让挂起的收发立即返回
+    shutdown(fd, SHUT_RDWR);
+#endif
+}
+
 IOManager *IOManager::GetThis() {
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
 
+int IOManager::nextReactorThread(int fd) {
+    if(!m_multiReactor || m_threadIds.empty()) {
+        return -1;
+    }
+    size_t next = m_nextThread++;
+    if(fd != -1 && m_numaSpread) {
+        int node = GetSocketNumaNode(fd);
+        // 从轮到的位置开始找第一个在这个节点上的线程，找不到就不挑节点
+        for(size_t i = 0; node >= 0 && i < m_threadIds.size(); ++i) {
+            size_t index = (next + i) % m_threadIds.size();
+            if(m_threadNodes[index] == node) {
+                return m_threadIds[index];
+            }
+        }
+    }
+    return m_threadIds[next % m_threadIds.size()];
+}
+
+int IOManager::localReactorThread(int fd, int thread) {
+    if(!m_numaSpread) {
+        return thread;
+    }
+    int node = GetSocketNumaNode(fd);
+    for(size_t i = 0; node >= 0 && i < m_threadIds.size(); ++i) {
+        if(m_threadIds[i] == thread) {
+            if(m_threadNodes[i] >= 0 && m_threadNodes[i] != node) {
+                int next = nextReactorThread(fd);
+                return next == -1 ? thread : next;
+            }
+            break;
+        }
+    }
+    return thread;
+}
+
+IOManager::Poller *IOManager::getPoller() {
+    if(!m_multiReactor) {
+        return m_pollers[0];
+    }
+    int index = getProcessorIndex();
+    AZURE_ASSERT(index >= 0 && index < (int)m_pollers.size());
+    return m_pollers[index];
+}
+
+// 调用时持有fd_ctx->mutex
+IOManager::Poller *IOManager::ownerPoller(FdContext *fd_ctx) {
+    if(fd_ctx->poller < 0) {
+        int index = 0;
+        if(m_multiReactor) {
+            index = getProcessorIndex();
+            if(index < 0) {
+                index = m_nextPoller++ % m_pollers.size();
+            }
+        }
+        fd_ctx->poller = index;
+    }
+    return m_pollers[fd_ctx->poller];
+}
+
+// 只在有线程阻塞在epoll_wait时才写eventfd，并且同一时间只有一次唤醒在路上
+bool IOManager::wakePoller(Poller *poller) {
+    if(poller->sleepingCount == 0) {
+        return false;
+    }
+    if(poller->tickled.exchange(true)) {
+        return false;
+    }
+    uint64_t one = 1;
+    int rt = write(poller->tickleFd, &one, sizeof(one));
+    AZURE_ASSERT(rt == sizeof(one));
+    return true;
+}
+
+// 被唤醒的线程取到任务后如果还有剩余任务，会在Scheduler::run里接力唤醒下一个线程
 void IOManager::tickle() {
-    if(!hasIdleThreads()) {
+    // 和idle里的 ++sleepingCount 配对，保证要么这里看到有线程在睡，要么睡眠线程看到新任务
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!m_multiReactor) {
+        wakePoller(m_pollers[0]);
         return;
     }
-    int rt = write(m_tickleFds[1], "T", 1);
-    AZURE_ASSERT(rt == 1);
+    // 任意一个睡眠中的线程都可以处理，从不同的位置开始找，避免总是唤醒同一个
+    size_t n = m_pollers.size();
+    size_t start = m_nextPoller++;
+    for(size_t i = 0; i < n; ++i) {
+        if(wakePoller(m_pollers[(start + i) % n])) {
+            return;
+        }
+    }
+}
+
+void IOManager::tickleThread(int thread) {
+    if(!m_multiReactor) {
+        tickle();
+        return;
+    }
+    int index = getProcessorIndex(thread);
+    if(index < 0) {
+        tickle();
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wakePoller(m_pollers[index]);
+}
+
+void IOManager::tickleTimerShard(int shard) {
+    if(m_multiReactor && shard >= 0 && shard < (int)m_pollers.size()) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wakePoller(m_pollers[shard]);
+        return;
+    }
+    // 所有线程共用一个epoll，tickle唤醒的不一定是属主；投递一个绑定属主线程的空任务，
+    // 属主执行完回到idle时会先处理邮箱再重新计算超时
+    int thread = getProcessorThread(shard);
+    if(thread < 0) {
+        tickle();
+        return;
+    }
+    schedule([](){}, thread);
+}
+
+IOManager::PollStats IOManager::getPollStats() const {
+    PollStats stats;
+    for(auto poller : m_pollers) {
+        stats.spinHits += poller->spinHits;
+        stats.spinMisses += poller->spinMisses;
+        stats.sleeps += poller->sleeps;
+    }
+    return stats;
+}
+
+// 反复非阻塞地epoll_wait并检查任务队列，直到有事可做或者用完spin_us
+// 返回就绪的事件数，0表示有可运行的任务，-1表示预算用完
+int IOManager::spinPoll(Poller *poller, epoll_event *events, int max_events, uint64_t spin_us) {
+    uint64_t deadline = GetCurrentUS() + spin_us;
+    do {
+        int rt = epoll_wait(poller->epfd, events, max_events, 0);
+        if(rt > 0) {
+            return rt;
+        }
+        if(hasRunnableTask()) {
+            return 0;
+        }
+    } while(GetCurrentUS() < deadline);
+    return -1;
 }
 
 bool IOManager::stopping(uint64_t &timeout) {
     timeout = getNextTimer();
-    return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+    // 其他线程的分片里可能还有定时器
+    return timeout == ~0ull && !hasTimer() && m_pendingEventCount == 0 && Scheduler::stopping();
 }
 
 bool IOManager::stopping() {
@@ -278,8 +653,10 @@ bool IOManager::stopping() {
 void IOManager::idle() {
     AZURE_LOG_INFO(g_logger) << "iomanager idle";
 
-    epoll_event *events = new epoll_event[64]();
-    std::shared_ptr<epoll_event> shared_events(events, [](epoll_event *ptr){delete[] ptr;});
+    Poller *poller = getPoller();
+    int max_events = std::max<uint32_t>(g_iomanager_epoll_events->getValue(), 1);
+    std::vector<epoll_event> events(max_events);
+    uint64_t spin_budget = m_spinUs;                // 本线程当前的自旋预算
     
     int rt = 0;
     // 该idle协程永远不会终止，只会切来切去
@@ -300,7 +677,47 @@ void IOManager::idle() {
             else {
                 next_timeout = MAX_TIMEOUT;
             }
-            rt = epoll_wait(m_epollfd, events, 64, (int)next_timeout);
+            if(poller->uring) {
+                // 一次系统调用提交本轮攒下的所有io_uring操作
+                Uring::MutexType::Lock lock(poller->uring->getMutex());
+                poller->uring->submit();
+            }
+
+            bool spun = false;
+            if(spin_budget > 0 && next_timeout > 0 && !hasRunnableTask()) {
+                rt = spinPoll(poller, events.data(), max_events, std::min<uint64_t>(spin_budget, next_timeout * 1000));
+                if(rt >= 0) {
+                    // 自旋等到了，说明负载还在，预算加倍
+                    ++poller->spinHits;
+                    spin_budget = std::min(spin_budget * 2, m_spinUs);
+                    break;
+                }
+                ++poller->spinMisses;
+                spin_budget /= 2;
+                spun = true;
+            }
+
+            ++poller->sleepingCount;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // 登记睡眠之后再检查一次队列，避免投递方没看到睡眠线程而漏掉唤醒
+            if(hasRunnableTask()) {
+                next_timeout = 0;
+            }
+            else if(spun) {
+                // 自旋期间插到最前面的定时器不会唤醒没登记睡眠的线程，重新取一次
+                next_timeout = std::min(next_timeout, getNextTimer());
+            }
+            if(next_timeout > 0) {
+                ++poller->sleeps;
+            }
+            uint64_t sleep_begin = m_spinUs ? GetCurrentUS() : 0;
+            rt = epoll_wait(poller->epfd, events.data(), max_events, (int)next_timeout);
+            --poller->sleepingCount;
+
+            // 预算减到0之后，如果阻塞不到一个自旋周期就被唤醒，说明负载又上来了，重新开始自旋
+            if(m_spinUs && spin_budget == 0 && rt > 0 && GetCurrentUS() - sleep_begin < m_spinUs) {
+                spin_budget = std::max<uint64_t>(m_spinUs / 8, 1);
+            }
 
             if(rt < 0 && errno == EINTR) {  // EINTER 中断了
                 ;
@@ -310,61 +727,84 @@ void IOManager::idle() {
             }
         } while(true);
 
-        // 获取满足条件的超时事件
+        // 超时任务、io_uring完成和就绪的io事件都先攒进本线程的批次，最后一次投递到本地队列
         std::vector<std::function<void()>> cbs;
         listExpiredCb(cbs);
-        if(!cbs.empty()) {
-            schedule(cbs.begin(), cbs.end());   // 添加超时任务
-            cbs.clear();
+        for(auto &cb : cbs) {
+            batchSchedule(&cb);
+        }
+        cbs.clear();
+
+        size_t triggered = 0;
+        if(poller->uring) {
+            triggered += reapUring(poller);
         }
 
         for(int i = 0; i < rt; ++i) {
             epoll_event &event = events[i];
-            if(event.data.fd == m_tickleFds[0]) {
-                uint8_t dummy;
-                while(read(m_tickleFds[0], &dummy, 1) == 1);
+            if(poller->uring && event.data.fd == poller->uring->getFd()) {
+                continue;
+            }
+            if(event.data.fd == poller->tickleFd) {
+                uint64_t dummy;
+                while(read(poller->tickleFd, &dummy, sizeof(dummy)) < 0 && errno == EINTR);
+                poller->tickled = false;
                 continue;
             }
 
             FdContext *fd_ctx = (FdContext *)event.data.ptr;
             FdContext::MutexType::Lock lock(fd_ctx->mutex);
+            // fd已经关闭并重新注册到了其他epoll，这是过期的事件
+            if(fd_ctx->poller < 0 || m_pollers[fd_ctx->poller] != poller) {
+                continue;
+            }
             if(event.events & (EPOLLERR | EPOLLHUP)) {  // 错误或中断
                 event.events |= EPOLLIN | EPOLLOUT;     // 唤醒读和写事件
             }
 
             int real_events = NONE;
-            if(event.events & EPOLLIN) {
+            if(event.events & (EPOLLIN | EPOLLRDHUP)) {
                 real_events |= READ;
             }
             if(event.events & EPOLLOUT) {
                 real_events |= WRITE;
             }
 
-            if((fd_ctx->events & real_events) == NONE) {
-                continue;
+            if(m_persistent) {
+                // 没有协程在等的方向记下来，下一次addEvent直接返回就绪
+                fd_ctx->ready = (Event)(fd_ctx->ready | (real_events & ~fd_ctx->events));
+                real_events &= fd_ctx->events;
+                if(real_events == NONE) {
+                    continue;
+                }
             }
-
-            int left_events = (fd_ctx->events & ~real_events);
-            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | left_events;
-
-            int rt2 = epoll_ctl(m_epollfd, op, fd_ctx->fd, &event);
-            if(rt2) {
-                AZURE_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epollfd << ", " << op << ", " << fd_ctx->fd << ", " << event.events
-                                        << "):" << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
-                continue;
+            else {
+                // EPOLLERR/EPOLLHUP 会带上没有注册的方向
+                real_events &= fd_ctx->events;
+                if(real_events == NONE) {
+                    continue;
+                }
+                if(!updateInterest(fd_ctx, (Event)(fd_ctx->events & ~real_events))) {
+                    continue;
+                }
             }
 
             if(real_events & READ) {
-                fd_ctx->triggerEvent(READ);
-                --m_pendingEventCount;
+                fd_ctx->triggerEvent(READ, this);
+                ++triggered;
             }
             if(real_events & WRITE) {
-                fd_ctx->triggerEvent(WRITE);
-                --m_pendingEventCount;
+                fd_ctx->triggerEvent(WRITE, this);
+                ++triggered;
             }
         }
 
+        // 先让任务可见再扣减等待计数，其他线程不会在这中间误判可以退出
+        flushBatch();
+        if(triggered) {
+            m_pendingEventCount -= triggered;
+        }
+
         Fiber::ptr cur = Fiber::GetThis();
         auto raw_ptr = cur.get();
         cur.reset();
@@ -2,6 +2,7 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
 
 namespace azure {
 
@@ -9,6 +10,16 @@ static azure::Logger::ptr g_logger = AZURE_LOG_NAME("system");
 
 static thread_local Scheduler *t_scheduler = nullptr;       // 当前使用中的协程调度器（一般只存在一个协程调度器）
 static thread_local Fiber *t_scheduler_fiber = nullptr;     // 调度协程，每个线程的主协程会被设置为调度线程，用于协程切换
+static thread_local int t_processor_index = -1;             // 当前线程在 m_processors 中的下标
+static thread_local bool t_in_run = false;                  // 当前线程是否正在执行run()
+
+// 每调度多少次检查一次全局队列，防止全局队列里的任务饿死
+static const uint32_t s_global_check_interval = 61;
+
+// 每个调度线程缓存的已结束协程数，用来执行新的callback，0表示不缓存
+static ConfigVar<uint32_t>::ptr g_fiber_pool_size = Config::Lookup<uint32_t>("scheduler.fiber_pool_size", 128, "terminated fibers cached per scheduler thread");
+// 每个线程缓存的空闲任务节点数
+static const size_t s_task_cache_size = 1024;
 
 // 这里的 use_caller 就是说把 Scheduler 即主线程也当作工作线程之一
 // 主线程作为工作线程，与其他工作线程的区别在于，主线程的 root 协程负责调度，
@@ -18,8 +29,9 @@ static thread_local Fiber *t_scheduler_fiber = nullptr;     // 调度协程，
 // t_threadFiber --> t_scheduler_fiber(m_rootFiber) --> idle --> t_scheduler_fiber(m_rootFiber) （在没有工作线程的情况下）
 // 如果不把主线程当作工作线程，那么主线程负责 start，schedule，stop，工作线程负责负责调度，协程切换顺序是：
 // t_threadFiber（MainFunc为空，执行线程逻辑）--> idle --> t_threadFiber --> idle
-Scheduler::Scheduler(size_t thread_num, bool use_caller, const std::string &name) 
-    : m_name(name) {
+Scheduler::Scheduler(size_t thread_num, bool use_caller, const std::string &name, const AffinityPolicy &affinity) 
+    : m_name(name)
+    , m_affinity(affinity) {
     AZURE_ASSERT(thread_num > 0);
 
     if(use_caller) {
@@ -38,18 +50,42 @@ Scheduler::Scheduler(size_t thread_num, bool use_caller, const std::string &name
         t_scheduler_fiber = m_rootFiber.get();
         m_rootThreadId = azure::GetThreadId();
         m_threadIds.push_back(m_rootThreadId);
+        m_threadNodes.push_back(-1);
+
+        m_processors.push_back(new Processor);
+        m_processors[0]->threadId = m_rootThreadId;
+        t_processor_index = 0;
     }
     else {
         // t_scheduler = this;  // 不加这个主线程无法获取调度器
         m_rootThreadId = -1;
     }
     m_threadCount = thread_num;
+
+    // 工作线程的Processor在构造时就分配好，start之前也可以调度
+    for(size_t i = 0; i < thread_num; ++i) {
+        m_processors.push_back(new Processor);
+    }
 }
 
 Scheduler::~Scheduler() {
     AZURE_ASSERT(m_stopping);
     if(GetThis() == this) {
         t_scheduler = nullptr;
+        t_processor_index = -1;
+    }
+
+    for(auto &proc : m_processors) {
+        while(FiberAndThread *ft = proc->runq.pop()) {
+            delete ft;
+        }
+        while(FiberAndThread *ft = proc->pinned.pop_front()) {
+            delete ft;
+        }
+        delete proc;
+    }
+    while(FiberAndThread *ft = m_fibers.pop_front()) {
+        delete ft;
     }
 }
 
@@ -72,10 +108,38 @@ void Scheduler::start() {
     AZURE_ASSERT(m_threads.empty());
 
     m_threads.resize(m_threadCount);
+    std::vector<std::vector<int>> cpus = m_affinity.plan(m_threadCount);
+    int first_node = -1;
+    size_t offset = m_rootFiber ? 1 : 0;
     for(size_t i = 0; i < m_threadCount; ++i) {
+        // 线程先绑核、绑定自己的Processor再进入调度循环
+        int index = i + offset;
+        std::vector<int> &thread_cpus = cpus[i];
         // Thread::run里存在信号量，保证构造函数返回之前线程已经运行起来，可以安全地获取到线程id
-        m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
+        m_threads[i].reset(new Thread([this, index, thread_cpus](){
+            if(!thread_cpus.empty()) {
+                SetThreadAffinity(thread_cpus);
+            }
+            t_processor_index = index;
+            m_processors[index]->threadId = azure::GetThreadId();
+            run();
+        }, m_name + "_" + std::to_string(i)));
         m_threadIds.push_back(m_threads[i]->getId());
+
+        int node = thread_cpus.empty() ? -1 : GetCpuNumaNode(thread_cpus[0]);
+        m_threadNodes.push_back(node);
+        if(node >= 0) {
+            if(first_node < 0) {
+                first_node = node;
+            }
+            else if(node != first_node) {
+                m_numaSpread = true;
+            }
+        }
+    }
+    if(m_affinity.type != AffinityPolicy::NONE) {
+        AZURE_LOG_INFO(g_logger) << m_name << " affinity=" << AffinityPolicy::TypeToString(m_affinity.type)
+                                 << " threads=" << m_threadCount << " numa_spread=" << m_numaSpread;
     }
 }
 
@@ -135,6 +199,7 @@ void Scheduler::run() {
     set_hook_enable(true);
 
     setThis();  // 设置当前Scheduler
+    t_in_run = true;
     
     // 如果不是主线程，初始化主协程，赋值给当前调度协程
     // 有点蠢，按现在（p35）的写法只需要初始化一次t_scheduler_fiber就够了，切换时用到的协程
@@ -150,6 +215,14 @@ void Scheduler::run() {
     // LEARN 这里 bind函数靠 this 来区分父类和子类（Sheduler 和 IOManager）？
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));    // 所有协程任务都完成就运行idle_fiber
     Fiber::ptr cb_fiber;    // 如果取得的是callback，就用这个协程执行
+    std::vector<Fiber::ptr> fiber_pool;     // 本线程执行结束的协程，复用来执行callback，省掉Fiber对象和栈的分配
+    const size_t pool_size = g_fiber_pool_size->getValue();
+    // 协程池只复用栈不小于默认大小的协程，fiber.stack_size 在 fiber.cpp 里定义
+    ConfigVar<uint32_t>::ptr stack_size = Config::Lookup<uint32_t>("fiber.stack_size");
+    fiber_pool.reserve(pool_size);
+
+    Processor *proc = getProcessor();
+    AZURE_ASSERT(proc);
 
     FiberAndThread ft;
 
@@ -157,30 +230,21 @@ void Scheduler::run() {
         ft.reset();
         bool tickle_me = false;
         bool is_active = false;
-        // 从协程队列里取出一个要执行的协程
-        {
-            MutexType::Lock lock(m_mutex);
-            auto it = m_fibers.begin();
-            while(it != m_fibers.end()) {
-                // 协程指定的线程不是当前线程
-                if(it->thread != -1 && it->thread != azure::GetThreadId()) {
-                    ++it;
-                    tickle_me = true;   // 通知其他线程处理
-                    continue;
-                }
-
-                AZURE_ASSERT(it->fiber || it->cb);
-                if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++it;
-                    continue;
-                }
-
-                ft = *it;
-                m_fibers.erase(it++);
-                ++m_activeThreadCount;
-                is_active = true;
-                break;
-            }
+        // 依次从指定本线程的队列、本地队列、全局队列取任务，都没有就去其他线程窃取
+        FiberAndThread *task = dequeue(proc, tickle_me);
+        if(task) {
+            ft.fiber.swap(task->fiber);
+            ft.cb.swap(task->cb);
+            ft.thread = task->thread;
+            FreeTask(task);
+            ++m_activeThreadCount;
+            is_active = true;
+            --m_taskCount;  // 先增加活跃线程数再减少任务数，stopping() 不会看到两者同时为0
+        }
+
+        // 取到任务后还有剩余任务，接力唤醒一个空闲线程，而不是投递时把所有线程都唤醒
+        if(task && m_taskCount > 0 && hasIdleThreads()) {
+            tickle_me = true;
         }
 
         if(tickle_me) {
@@ -188,37 +252,50 @@ void Scheduler::run() {
         }
 
         if(ft.fiber && ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT) {
+            ft.fiber->m_handoff.store(1, std::memory_order_relaxed);
             ft.fiber->swapIn();
             --m_activeThreadCount;  // 已经从协程里返回了
 
-            if(ft.fiber->getState() == Fiber::READY) {  // 如果执行了YieldToReady，再次入队等待调度
-                schedule(ft.fiber); // DEBUG 可以指定运行该协程的线程
+            if(ft.fiber->getState() != Fiber::READY && ft.fiber->getState() != Fiber::TERM
+                    && ft.fiber->getState() != Fiber::EXCEPT) {     // 让出了执行时间
+                ft.fiber->m_state = Fiber::HOLD;
             }
-            else if(ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT) {     // 让出了执行时间
-                ft.fiber->m_state = Fiber::HOLD;    // DEBUG 不用入队吗？
+            // 执行结束且没有其他引用的协程放回池子，带自定义栈大小的不复用
+            else if(ft.fiber->getState() != Fiber::READY && ft.fiber.unique() && fiber_pool.size() < pool_size
+                    && ft.fiber->m_stacksize >= stack_size->getValue()) {
+                fiber_pool.push_back(ft.fiber);
             }
+            releaseFiber(ft.fiber);  // YieldToReady的再次入队，执行期间被唤醒的这时才入队
             ft.reset();             // 析构Fiber
         }
         else if(ft.cb) {
             if(cb_fiber) {
                 cb_fiber->reset(ft.cb);             // 对象的reset方法
             }
+            else if(!fiber_pool.empty()) {
+                cb_fiber.swap(fiber_pool.back());
+                fiber_pool.pop_back();
+                cb_fiber->reset(ft.cb);
+            }
             else {
                 cb_fiber.reset(new Fiber(ft.cb));   // 智能指针reset
             }
             ft.reset();
+            cb_fiber->m_handoff.store(1, std::memory_order_relaxed);
             cb_fiber->swapIn();
             --m_activeThreadCount;
             if(cb_fiber->getState() == Fiber::READY) {
-                schedule(cb_fiber);                 // YieldToReady 再入队
+                releaseFiber(cb_fiber);             // YieldToReady 再入队
                 cb_fiber.reset();
             }
             else if(cb_fiber->getState() == Fiber::EXCEPT || cb_fiber->getState() == Fiber::TERM) {
                 cb_fiber->reset(nullptr);           // callback reset
+                releaseFiber(cb_fiber);
             }
             else {
                 // AZURE_LOG_INFO(g_logger) << "----- cb_fiber.use_count()=" << cb_fiber.use_count();
                 cb_fiber->m_state = Fiber::HOLD;
+                releaseFiber(cb_fiber);
                 cb_fiber.reset();
                 // AZURE_LOG_INFO(g_logger) << "----- cb_fiber.use_count()=" << cb_fiber.use_count();
             }
@@ -242,6 +319,7 @@ void Scheduler::run() {
             }
         }
     }
+    t_in_run = false;
 }
 
 void Scheduler::tickle() {
@@ -249,8 +327,23 @@ void Scheduler::tickle() {
 }
 
 bool Scheduler::stopping() {
-    MutexType::Lock lock(m_mutex);
-    return m_autostop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+    return m_autostop && m_stopping && m_taskCount == 0 && m_activeThreadCount == 0;
+}
+
+bool Scheduler::hasRunnableTask() {
+    if(m_globalCount > 0) {
+        return true;
+    }
+    Processor *proc = getProcessor();
+    if(proc && proc->pinnedCount > 0) {
+        return true;
+    }
+    for(auto &i : m_processors) {
+        if(i->runq.size() > 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void Scheduler::idle() {
@@ -264,4 +357,360 @@ void Scheduler::idle() {
     }
 }   
 
-}
\ No newline at end of file
+Scheduler::LocalQueue::LocalQueue()
+    : m_head(0)
+    , m_tail(0) {
+    for(uint32_t i = 0; i < CAPACITY; ++i) {
+        m_buf[i] = nullptr;
+    }
+}
+
+bool Scheduler::LocalQueue::push(FiberAndThread *ft) {
+    uint32_t h = m_head.load(std::memory_order_acquire);
+    uint32_t t = m_tail.load(std::memory_order_relaxed);
+    if(t - h >= CAPACITY) {
+        return false;
+    }
+    m_buf[t % CAPACITY].store(ft, std::memory_order_relaxed);
+    m_tail.store(t + 1, std::memory_order_release);    // 发布给窃取线程
+    return true;
+}
+
+Scheduler::FiberAndThread *Scheduler::LocalQueue::pop() {
+    while(true) {
+        uint32_t h = m_head.load(std::memory_order_acquire);
+        uint32_t t = m_tail.load(std::memory_order_relaxed);
+        if(t == h) {
+            return nullptr;
+        }
+        FiberAndThread *ft = m_buf[h % CAPACITY].load(std::memory_order_relaxed);
+        if(m_head.compare_exchange_weak(h, h + 1, std::memory_order_release)) {
+            return ft;
+        }
+    }
+}
+
+// 参考 Go runtime 的 runqsteal，一次偷走一半，减少窃取次数
+uint32_t Scheduler::LocalQueue::stealInto(LocalQueue &dst) {
+    uint32_t t = dst.m_tail.load(std::memory_order_relaxed);
+    while(true) {
+        uint32_t h = m_head.load(std::memory_order_acquire);
+        uint32_t tail = m_tail.load(std::memory_order_acquire);
+        uint32_t n = tail - h;
+        n = n - n / 2;
+        if(n == 0) {
+            return 0;
+        }
+        if(n > CAPACITY / 2) {  // 读到的 head 和 tail 不一致，重试
+            continue;
+        }
+        for(uint32_t i = 0; i < n; ++i) {
+            FiberAndThread *ft = m_buf[(h + i) % CAPACITY].load(std::memory_order_relaxed);
+            dst.m_buf[(t + i) % CAPACITY].store(ft, std::memory_order_relaxed);
+        }
+        if(m_head.compare_exchange_weak(h, h + n, std::memory_order_acq_rel)) {
+            dst.m_tail.store(t + n, std::memory_order_release);
+            return n;
+        }
+    }
+}
+
+uint32_t Scheduler::LocalQueue::size() const {
+    uint32_t h = m_head.load(std::memory_order_acquire);
+    uint32_t t = m_tail.load(std::memory_order_acquire);
+    return t - h;
+}
+
+Scheduler::Processor *Scheduler::getProcessor() {
+    if(t_scheduler != this || t_processor_index < 0) {
+        return nullptr;
+    }
+    return m_processors[t_processor_index];
+}
+
+int Scheduler::getProcessorIndex() {
+    if(t_scheduler != this) {
+        return -1;
+    }
+    return t_processor_index;
+}
+
+int Scheduler::getProcessorThread(int index) {
+    if(index < 0 || index >= (int)m_processors.size()) {
+        return -1;
+    }
+    return m_processors[index]->threadId;
+}
+
+int Scheduler::getRunningProcessorIndex() {
+    if(t_scheduler != this || !t_in_run) {
+        return -1;
+    }
+    return t_processor_index;
+}
+
+int Scheduler::getProcessorIndex(int thread) {
+    for(size_t i = 0; i < m_processors.size(); ++i) {
+        if(m_processors[i]->threadId == thread) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+Scheduler::Processor *Scheduler::findProcessor(int thread) {
+    for(auto &proc : m_processors) {
+        if(proc->threadId == thread) {
+            return proc;
+        }
+    }
+    return nullptr;
+}
+
+bool Scheduler::enqueue(FiberAndThread *ft) {
+    // 从无到有才进行通知
+    bool need_tickle = (m_taskCount++ == 0);
+    Processor *self = getProcessor();
+
+    if(ft->thread != -1) {
+        Processor *proc = findProcessor(ft->thread);
+        if(proc) {
+            MutexType::Lock lock(proc->mutex);
+            proc->pinned.push_back(ft);
+            ++proc->pinnedCount;
+            return need_tickle || proc != self;
+        }
+        // 找不到指定的线程（线程还没启动），放到全局队列，由对应线程取走
+    }
+    else if(self && self->runq.push(ft)) {
+        return need_tickle;
+    }
+
+    MutexType::Lock lock(m_mutex);
+    m_fibers.push_back(ft);
+    ++m_globalCount;
+    return need_tickle || !self;
+}
+
+void Scheduler::flushBatch() {
+    Processor *proc = getProcessor();
+    if(!proc || proc->batch.empty()) {
+        return;
+    }
+    // 整批只更新一次计数
+    m_taskCount.fetch_add(proc->batchCount);
+    proc->batchCount = 0;
+
+    bool overflow = false;
+    FiberAndThread *ft = nullptr;
+    while((ft = proc->batch.pop_front())) {
+        if(!proc->runq.push(ft)) {
+            // 本地队列满了，剩下的一次加锁放进全局队列
+            MutexType::Lock lock(m_mutex);
+            do {
+                m_fibers.push_back(ft);
+                ++m_globalCount;
+            } while((ft = proc->batch.pop_front()));
+            overflow = true;
+            break;
+        }
+    }
+    // 当前线程马上就会执行这批任务，不用通知；其他空闲线程由run里的接力唤醒叫起来窃取
+    if(overflow) {
+        tickle();
+    }
+}
+
+Scheduler::FiberAndThread *Scheduler::popGlobal() {
+    if(m_globalCount == 0) {
+        return nullptr;
+    }
+    int thread_id = azure::GetThreadId();
+    MutexType::Lock lock(m_mutex);
+    FiberAndThread *ft = m_fibers.pop_thread(thread_id);
+    if(ft) {
+        --m_globalCount;
+    }
+    return ft;
+}
+
+Scheduler::FiberAndThread *Scheduler::steal(Processor *proc) {
+    size_t n = m_processors.size();
+    if(n <= 1) {
+        return nullptr;
+    }
+    // 从随机位置开始，避免所有空闲线程都去偷同一个线程
+    // rand() 内部有锁，这里用线程局部的 xorshift
+    static thread_local uint32_t s_seed = azure::GetThreadId();
+    s_seed ^= s_seed << 13;
+    s_seed ^= s_seed >> 17;
+    s_seed ^= s_seed << 5;
+    size_t start = s_seed % n;
+    for(size_t i = 0; i < n; ++i) {
+        Processor *victim = m_processors[(start + i) % n];
+        if(victim == proc) {
+            continue;
+        }
+        if(victim->runq.stealInto(proc->runq) > 0) {
+            return proc->runq.pop();
+        }
+    }
+    return nullptr;
+}
+
+bool Scheduler::deferSchedule(Fiber *fiber, int thread) {
+    int running = 1;
+    return fiber->m_handoff.compare_exchange_strong(running, thread + 3, std::memory_order_acq_rel);
+}
+
+void Scheduler::releaseFiber(const Fiber::ptr &fiber) {
+    // 先读状态再清标记：清掉之后其他线程随时可能恢复它
+    Fiber::State state = fiber->getState();
+    int pending = fiber->m_handoff.exchange(0, std::memory_order_acq_rel);
+    if(state == Fiber::READY) {
+        schedule(fiber);
+    }
+    else if(pending > 1 && state == Fiber::HOLD) {
+        schedule(fiber, pending - 3);
+    }
+}
+
+Scheduler::FiberAndThread *Scheduler::dequeue(Processor *proc, bool &tickle_me) {
+    static thread_local uint32_t s_tick = 0;
+    FiberAndThread *ft = nullptr;
+
+    if(proc->pinnedCount > 0) {
+        MutexType::Lock lock(proc->mutex);
+        ft = proc->pinned.pop_front();
+        if(ft) {
+            --proc->pinnedCount;
+        }
+    }
+    if(!ft && ++s_tick % s_global_check_interval == 0) {
+        ft = popGlobal();
+    }
+    if(!ft) {
+        ft = proc->runq.pop();
+    }
+    if(!ft) {
+        ft = popGlobal();
+    }
+    if(!ft) {
+        ft = steal(proc);
+    }
+    // 队列里的协程都已经切出去了（见releaseFiber），取到就能直接执行
+    if(ft) {
+        AZURE_ASSERT(ft->fiber || ft->cb);
+        return ft;
+    }
+
+    // 自己没有任务，但有指定其他线程执行的任务，通知其他线程处理
+    for(auto &i : m_processors) {
+        if(i != proc && i->pinnedCount > 0) {
+            tickleThread(i->threadId);
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::TaskList::push_back(FiberAndThread *ft) {
+    ft->next = nullptr;
+    if(tail) {
+        tail->next = ft;
+    }
+    else {
+        head = ft;
+    }
+    tail = ft;
+}
+
+Scheduler::FiberAndThread *Scheduler::TaskList::pop_front() {
+    FiberAndThread *ft = head;
+    if(ft) {
+        head = ft->next;
+        if(!head) {
+            tail = nullptr;
+        }
+        ft->next = nullptr;
+    }
+    return ft;
+}
+
+Scheduler::FiberAndThread *Scheduler::TaskList::pop_thread(int thread_id) {
+    FiberAndThread *prev = nullptr;
+    for(FiberAndThread *ft = head; ft; prev = ft, ft = ft->next) {
+        if(ft->thread != -1 && ft->thread != thread_id) {
+            continue;
+        }
+        if(prev) {
+            prev->next = ft->next;
+        }
+        else {
+            head = ft->next;
+        }
+        if(tail == ft) {
+            tail = prev;
+        }
+        ft->next = nullptr;
+        return ft;
+    }
+    return nullptr;
+}
+
+// 任务节点在投递线程分配，在执行线程归还，稳定运行后各线程的空闲链表大致平衡
+// 线程退出时缓存随之释放，之后再归还的节点直接delete
+struct Scheduler::TaskCache {
+    enum State {
+        NONE,
+        ALIVE,
+        DESTROYED
+    };
+
+    TaskList list;
+    size_t count = 0;
+
+    TaskCache() {
+        t_state = ALIVE;
+    }
+
+    ~TaskCache() {
+        t_state = DESTROYED;
+        while(FiberAndThread *ft = list.pop_front()) {
+            delete ft;
+        }
+    }
+
+    static thread_local int t_state;
+};
+
+thread_local int Scheduler::TaskCache::t_state = Scheduler::TaskCache::NONE;
+
+Scheduler::TaskCache *Scheduler::GetTaskCache() {
+    if(TaskCache::t_state == TaskCache::DESTROYED) {
+        return nullptr;
+    }
+    static thread_local TaskCache s_cache;
+    return &s_cache;
+}
+
+Scheduler::FiberAndThread *Scheduler::AllocTask() {
+    TaskCache *cache = GetTaskCache();
+    if(cache && cache->count > 0) {
+        --cache->count;
+        return cache->list.pop_front();
+    }
+    return new FiberAndThread;
+}
+
+void Scheduler::FreeTask(FiberAndThread *ft) {
+    TaskCache *cache = GetTaskCache();
+    if(cache && cache->count < s_task_cache_size) {
+        ft->reset();
+        cache->list.push_back(ft);
+        ++cache->count;
+        return;
+    }
+    delete ft;
+}
+
+}
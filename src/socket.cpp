@@ -7,11 +7,15 @@
 #include "macro.h"
 #include "hook.h"
 #include "iomanager.h"
+#include "config.h"
 
 namespace azure {
 
 static azure::Logger::ptr g_logger = AZURE_LOG_NAME("system");
 
+// TCP socket的SO_BUSY_POLL（微秒），0为不设置；超过net.core.busy_read需要CAP_NET_ADMIN
+static ConfigVar<uint32_t>::ptr g_socket_busy_poll_us = Config::Lookup<uint32_t>("socket.busy_poll_us", 0, "SO_BUSY_POLL for tcp sockets in microseconds");
+
 Socket::ptr Socket::CreateTCP(azure::Address::ptr address) {
     Socket::ptr sock(new Socket(address->getFamily(), Socket::TCP, 0));
     return sock;
@@ -57,7 +61,8 @@ Socket::Socket(int family, int type, int protocol)
     , m_family(family)
     , m_type(type)
     , m_protocol(protocol)
-    , m_isConnected(false) {
+    , m_isConnected(false)
+    , m_acceptedRecvTimeout(-1) {
 }
 
 Socket::~Socket() {
@@ -65,7 +70,7 @@ Socket::~Socket() {
 }
 
 int64_t Socket::getSendTimeout() {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sockfd);
+    FdCtx *ctx = FdMgr::GetInstance()->get(m_sockfd);
     if(ctx) {
         return ctx->getTimeout(SO_SNDTIMEO);
     }
@@ -78,7 +83,7 @@ void Socket::setSendTimeout(uint64_t v) {
 }
 
 int64_t Socket::getRecvTimeout() {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sockfd);
+    FdCtx *ctx = FdMgr::GetInstance()->get(m_sockfd);
     if(ctx) {
         return ctx->getTimeout(SO_RCVTIMEO);
     }
@@ -110,32 +115,82 @@ bool Socket::setOption(int level, int option, const void *result, size_t len) {
 }
 
 Socket::ptr Socket::accept() {
-    Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
-    int newsock = ::accept(m_sockfd, nullptr, nullptr);
+    int newsock = ::accept4(m_sockfd, nullptr, nullptr, SOCK_CLOEXEC);
     if(newsock == -1) {
         AZURE_LOG_ERROR(g_logger) << "accept(" << m_sockfd << ") errno=" << errno << " errstr=" << strerror(errno);
         return nullptr;
     }
-    if(sock->init(newsock)) {
-        return sock;
+    return newAccepted(newsock);
+}
+
+size_t Socket::accept(std::vector<Socket::ptr> &socks, size_t max) {
+    Socket::ptr first = accept();
+    if(!first) {
+        return 0;
+    }
+    socks.push_back(first);
+    size_t count = 1;
+
+    // 监听socket在内核里是非阻塞的才能直接取，否则会阻塞线程
+    FdCtx *ctx = FdMgr::GetInstance()->get(m_sockfd);
+    if(!is_hook_enable() || !ctx || !ctx->getSysNonblock()) {
+        return count;
+    }
+    while(count < max) {
+        int newsock = accept4_f(m_sockfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(newsock == -1) {
+            // EAGAIN：积压的连接取完了
+            if(errno != EAGAIN && errno != EINTR) {
+                AZURE_LOG_DEBUG(g_logger) << "accept4(" << m_sockfd << ") errno=" << errno << " errstr=" << strerror(errno);
+            }
+            break;
+        }
+        FdMgr::GetInstance()->attachSocket(newsock);
+        Socket::ptr sock = newAccepted(newsock);
+        if(sock) {
+            socks.push_back(sock);
+            ++count;
+        }
+    }
+    return count;
+}
+
+void Socket::setAcceptedRecvTimeout(uint64_t v) {
+    m_acceptedRecvTimeout = v;
+    // 绕过hook只设置内核里的值，监听socket上hook层的超时不变
+    struct timeval tv{int(v / 1000), int(v % 1000 * 1000)};
+    if(setsockopt_f(m_sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))) {
+        AZURE_LOG_DEBUG(g_logger) << "setsockopt SO_RCVTIMEO sockfd=" << m_sockfd << " errno=" << errno << " errstr=" << strerror(errno);
     }
-    return nullptr;
 }
 
+Socket::ptr Socket::newAccepted(int sockfd) {
+    Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
+    if(!sock->init(sockfd)) {
+        ::close(sockfd);
+        return nullptr;
+    }
+    if(m_acceptedRecvTimeout != (uint64_t)-1) {
+        FdCtx *ctx = FdMgr::GetInstance()->get(sockfd);
+        if(ctx) {
+            ctx->setTimeout(SO_RCVTIMEO, m_acceptedRecvTimeout);
+        }
+    }
+    return sock;
+}
+
+// accept出来的连接：TCP_NODELAY等选项从监听socket继承，不再initSock；地址用到时再取
 bool Socket::init(int sockfd) {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(sockfd);
+    FdCtx *ctx = FdMgr::GetInstance()->get(sockfd);
     if(ctx && ctx->isSocket() && !ctx->isClosed()) {
         m_sockfd = sockfd;
         m_isConnected = true;
-        initSock();
-        getLocalAddress();
-        getRemoteAddress();
         return true;
     }
     return false;
 }
 
-bool Socket::bind(const Address::ptr addr) {
+bool Socket::bind(const Address::ptr addr, bool reuse_port) {
     if(!isValid()) {
         newSock();
         if(AZURE_UNLIKELY(!isValid())) {
@@ -148,6 +203,11 @@ bool Socket::bind(const Address::ptr addr) {
         return false;
     }
 
+    if(reuse_port && !setOption(SOL_SOCKET, SO_REUSEPORT, 1)) {
+        AZURE_LOG_ERROR(g_logger) << "setsockopt SO_REUSEPORT error, errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+
     if(::bind(m_sockfd, addr->getAddr(), addr->getAddrLen())) {
         AZURE_LOG_ERROR(g_logger) << "bind error, errno=" << errno << " errstr=" << strerror(errno);
         return false;
@@ -257,6 +317,14 @@ int Socket::sendTo(const iovec *buffers, size_t length, const Address::ptr to, i
     return -1;
 }
 
+// ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+int Socket::sendFile(int in_fd, off_t *offset, size_t count) {
+    if(isConnected()) {
+        return ::sendfile(m_sockfd, in_fd, offset, count);
+    }
+    return -1;
+}
+
 // ssize_t recv(int sockfd, void *buf, size_t len, int flags)
 int Socket::recv(void *buffer, size_t length, int flags) {
     if(isConnected()) {
@@ -416,6 +484,10 @@ void Socket::initSock() {
     setOption(SOL_SOCKET, SO_REUSEADDR, val);
     if(m_type == SOCK_STREAM) {
         setOption(IPPROTO_TCP, TCP_NODELAY, val);   // 是否开启Nagle算法
+        int busy_poll = g_socket_busy_poll_us->getValue();
+        if(busy_poll > 0) {
+            setOption(SOL_SOCKET, SO_BUSY_POLL, busy_poll);     // 收包时在驱动队列上忙等，减少中断唤醒的延迟
+        }
     }
 }
 
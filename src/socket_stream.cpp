@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "socket_stream.h"
 
 namespace azure {
@@ -57,6 +58,36 @@ int SocketStream::write(ByteArray::ptr ba, size_t length) {
     return rt;
 }
 
+int SocketStream::writev(const iovec *iovs, size_t iovcnt) {
+    if(!isConnected()) {
+        return -1;
+    }
+    return m_socket->send(iovs, iovcnt);
+}
+
+int SocketStream::sendFile(int fd, uint64_t offset, uint64_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    off_t off = offset;
+    return m_socket->sendFile(fd, &off, length);
+}
+
+int SocketStream::sendFileFixSize(int fd, uint64_t offset, uint64_t length) {
+    uint64_t left = length;
+    while(left > 0) {
+        // 单次sendfile最多发2GB左右，返回值也要装进int
+        int len = sendFile(fd, offset, std::min<uint64_t>(left, 1ul << 30));
+        if(len <= 0) {
+            // 返回0是文件比length短，对端已经按length等着了，同样算失败
+            return -1;
+        }
+        offset += len;
+        left -= len;
+    }
+    return 0;
+}
+
 void SocketStream::close() {
     if(m_socket) {
         m_socket->close();
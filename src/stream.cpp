@@ -54,4 +54,39 @@ int Stream::writeFixSize(ByteArray::ptr ba, size_t length) {
     return length; 
 }
 
-}
\ No newline at end of file
+int Stream::writev(const iovec *iovs, size_t iovcnt) {
+    for(size_t i = 0; i < iovcnt; ++i) {
+        if(iovs[i].iov_len > 0) {
+            return write(iovs[i].iov_base, iovs[i].iov_len);
+        }
+    }
+    return 0;
+}
+
+int Stream::writevFixSize(iovec *iovs, size_t iovcnt) {
+    size_t length = 0;
+    for(size_t i = 0; i < iovcnt; ++i) {
+        length += iovs[i].iov_len;
+    }
+    size_t left = length;
+    while(left > 0) {
+        int len = writev(iovs, iovcnt);
+        if(len <= 0) {
+            return len;
+        }
+        left -= len;
+        // 跳过已经写完的，写了一部分的从剩下的位置开始
+        while(iovcnt > 0 && (size_t)len >= iovs->iov_len) {
+            len -= iovs->iov_len;
+            ++iovs;
+            --iovcnt;
+        }
+        if(len > 0) {
+            iovs->iov_base = (char *)iovs->iov_base + len;
+            iovs->iov_len -= len;
+        }
+    }
+    return length;
+}
+
+}
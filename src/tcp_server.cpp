@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "tcp_server.h"
 #include "config.h"
 #include "log.h"
@@ -7,13 +8,18 @@ namespace azure {
 static Logger::ptr g_logger = AZURE_LOG_NAME("system");
 
 static ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout = Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2), "tcp server read timeout");
+// 每个工作线程一个SO_REUSEPORT监听socket，在本线程accept和处理连接
+static ConfigVar<bool>::ptr g_tcp_server_reuse_port = Config::Lookup("tcp_server.reuse_port", false, "one SO_REUSEPORT listener per worker thread");
+// 一次就绪最多取多少个积压的连接
+static ConfigVar<uint32_t>::ptr g_tcp_server_accept_batch = Config::Lookup<uint32_t>("tcp_server.accept_batch", 64, "max connections accepted per readiness event");
 
 TcpServer::TcpServer(azure::IOManager *worker, azure::IOManager *accept_worker)
     : m_ioworker(worker)
     , m_acceptWorker(accept_worker)
     , m_readTimeout(g_tcp_server_read_timeout->getValue())
     , m_name("azure/1.0.0")
-    , m_isStop(true) {
+    , m_isStop(true)
+    , m_reusePort(g_tcp_server_reuse_port->getValue()) {
 }
 
 TcpServer::~TcpServer() {
@@ -21,6 +27,7 @@ TcpServer::~TcpServer() {
         i->close();
     }
     m_socks.clear();
+    m_sockThreads.clear();
 }
 
 bool TcpServer::bind(azure::Address::ptr addr) {
@@ -32,28 +39,41 @@ bool TcpServer::bind(azure::Address::ptr addr) {
 
 // 返回bind失败的地址
 bool TcpServer::bind(const std::vector<Address::ptr> &addrs, std::vector<Address::ptr> &fails) {
+    const std::vector<int> &threads = m_ioworker->getThreadIds();
     for(auto &addr : addrs) {
-        Socket::ptr sock = Socket::CreateTCP(addr);
-        if(!sock->bind(addr)) {
-            AZURE_LOG_ERROR(g_logger) << "bind fail, errno="
-                                      << errno << ", errstr=" << strerror(errno)
-                                      << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
-        }
-        if(!sock->listen()) {
-            AZURE_LOG_ERROR(g_logger) << "listen fail errno="
-                                    << errno << " errstr="
-                                    << strerror(errno)
-                                    << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
+        // 多监听模式下每个线程一个socket，unix socket不支持SO_REUSEPORT，仍然只有一个
+        bool per_thread = m_reusePort && addr->getFamily() != AF_UNIX && !threads.empty();
+        size_t count = per_thread ? threads.size() : 1;
+        Address::ptr bind_addr = addr;
+        for(size_t i = 0; i < count; ++i) {
+            Socket::ptr sock = Socket::CreateTCP(addr);
+            if(!sock->bind(bind_addr, per_thread)) {
+                AZURE_LOG_ERROR(g_logger) << "bind fail, errno="
+                                          << errno << ", errstr=" << strerror(errno)
+                                          << " addr=[" << bind_addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(!sock->listen()) {
+                AZURE_LOG_ERROR(g_logger) << "listen fail errno="
+                                        << errno << " errstr="
+                                        << strerror(errno)
+                                        << " addr=[" << bind_addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            // 端口为0时由第一个socket分配端口，其余的绑定到同一个端口
+            if(i == 0 && per_thread) {
+                bind_addr = sock->getLocalAddress();
+            }
+            m_socks.push_back(sock);
+            m_sockThreads.push_back(per_thread ? threads[i] : -1);
         }
-        m_socks.push_back(sock);
     }
 
     if(!fails.empty()) {
         m_socks.clear();
+        m_sockThreads.clear();
         return false;
     }
 
@@ -64,14 +84,39 @@ bool TcpServer::bind(const std::vector<Address::ptr> &addrs, std::vector<Address
 }
 
 void TcpServer::startAccept(Socket::ptr sock) {
+    // 多监听模式下每个socket属于一个工作线程，新连接留在这个线程处理
+    int owner = -1;
+    for(size_t i = 0; i < m_socks.size(); ++i) {
+        if(m_socks[i] == sock) {
+            owner = m_sockThreads[i];
+            break;
+        }
+    }
+    bool local = owner != -1 && IOManager::GetThis() == m_ioworker;
+    size_t batch = std::max<uint32_t>(g_tcp_server_accept_batch->getValue(), 1);
+    std::vector<Socket::ptr> clients;
     while(!m_isStop) {
-        Socket::ptr client = sock->accept();
-        if(client) {
-            client->setRecvTimeout(m_readTimeout);
-            m_ioworker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
+        // 读超时设置到监听socket上，由新连接继承；start之后setReadTimeout的，下一批连接开始生效
+        if(sock->getAcceptedRecvTimeout() != m_readTimeout) {
+            sock->setAcceptedRecvTimeout(m_readTimeout);
         }
-        else {
+        clients.clear();
+        if(!sock->accept(clients, batch)) {
             AZURE_LOG_ERROR(g_logger) << "accept errno=" << errno << " errstr=" << strerror(errno);
+            continue;
+        }
+        for(auto &client : clients) {
+            if(local) {
+                m_ioworker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client), m_ioworker->localReactorThread(client->getSocket(), owner));
+                continue;
+            }
+            // 多reactor模式下新连接轮流交给各个工作线程（线程绑了NUMA节点时优先交给网卡所在节点），连接之后的事件都在这个线程处理
+            m_ioworker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client), m_ioworker->nextReactorThread(client->getSocket()));
+        }
+        // 唤醒accept协程的事件可能被别的线程取走（共用epoll，或者被窃取），回到所属线程再接着accept
+        if(local && GetThreadId() != owner) {
+            m_ioworker->schedule(Fiber::GetThis(), owner);
+            Fiber::YieldToHold();
         }
     }
 }
@@ -82,8 +127,13 @@ bool TcpServer::start() {
         return true;
     }
     m_isStop = false;
-    for(auto &sock : m_socks) {
-        m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), sock));
+    for(size_t i = 0; i < m_socks.size(); ++i) {
+        if(m_sockThreads[i] != -1) {
+            m_ioworker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), m_socks[i]), m_sockThreads[i]);
+        }
+        else {
+            m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), m_socks[i]));
+        }
     }
     return true;
 }
@@ -97,6 +147,7 @@ void TcpServer::stop() {
             sock->close();
         }
         m_socks.clear();
+        m_sockThreads.clear();
     });
 }
 
@@ -1,5 +1,8 @@
+#include <string.h>
 #include "timer.h"
 #include "util.h"
+#include "config.h"
+#include "macro.h"
 
 namespace azure {
 
@@ -34,71 +37,292 @@ Timer::Timer(uint64_t next)
 
 // 取消定时器
 bool Timer::cancel() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(m_cb) {
-        m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
-        return true;
+    int expected = ACTIVE;
+    if(!m_state.compare_exchange_strong(expected, CANCELLED)) {
+        return false;
     }
-    return false;
+    m_manager->removeTimer(shared_from_this());
+    return true;
 }
 
 // 刷新定时器 m_next = azure::GetCurrentMS() + m_ms;
 bool Timer::refresh() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(!m_cb) {
+    if(m_state != ACTIVE) {
         return false;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
+    return m_manager->updateTimer(shared_from_this(), ~0ull, azure::GetCurrentMS());
+}
+
+// 修改超时时间
+bool Timer::reset(uint64_t ms, bool from_now) {
+    if(m_state != ACTIVE) {
         return false;
     }
-    m_manager->m_timers.erase(it);
-    m_next = azure::GetCurrentMS() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
+    return m_manager->updateTimer(shared_from_this(), ms, from_now ? azure::GetCurrentMS() : ~0ull);
+}
+
+bool TimerSet::insert(const Timer::ptr &timer) {
+    auto it = m_timers.insert(timer).first;
+    return it == m_timers.begin();
+}
+
+bool TimerSet::erase(const Timer::ptr &timer) {
+    auto it = m_timers.find(timer);
+    if(it == m_timers.end()) {
+        return false;
+    }
+    m_timers.erase(it);
     return true;
 }
 
-// 修改超时时间
-bool Timer::reset(uint64_t ms, bool from_now) {
-    if(ms == m_ms && !from_now) {
+uint64_t TimerSet::nextTime() {
+    return m_timers.empty() ? ~0ull : (*m_timers.begin())->m_next;
+}
+
+void TimerSet::listExpired(uint64_t now_ms, bool rollover, std::vector<Timer::ptr> &expired) {
+    if(m_timers.empty()) {
+        return;
+    }
+    if(!rollover && ((*m_timers.begin())->m_next > now_ms)) {
+        return;
+    }
+
+    Timer::ptr now_timer(new Timer(now_ms));
+    auto it = rollover ? m_timers.end() : m_timers.upper_bound(now_timer);
+    expired.insert(expired.end(), m_timers.begin(), it);
+    m_timers.erase(m_timers.begin(), it);
+}
+
+TimerWheel::TimerWheel()
+    : m_current(azure::GetCurrentMS()) {
+    memset(m_root, 0, sizeof(m_root));
+    memset(m_levels, 0, sizeof(m_levels));
+}
+
+TimerWheel::~TimerWheel() {
+    // 释放定时器对自己的引用
+    std::vector<Timer::ptr> timers;
+    listExpired(0, true, timers);
+}
+
+Timer **TimerWheel::slotOf(int level, uint64_t tick) {
+    if(level == 0) {
+        return &m_root[tick & (ROOT_SIZE - 1)];
+    }
+    int shift = ROOT_BITS + LEVEL_BITS * (level - 1);
+    return &m_levels[level - 1][(tick >> shift) & (LEVEL_SIZE - 1)];
+}
+
+void TimerWheel::place(Timer *timer) {
+    // 已经超时的放到当前槽，下一次处理时触发
+    uint64_t expires = timer->m_next > m_current ? timer->m_next : m_current;
+    uint64_t idx = expires - m_current;
+
+    int level = 0;
+    if(idx >= (uint64_t)ROOT_SIZE) {
+        for(level = 1; level < LEVELS; ++level) {
+            if(idx < (1ull << (ROOT_BITS + LEVEL_BITS * level))) {
+                break;
+            }
+        }
+        // 超出时间轮范围的放到最高层的最远处，下放时会重新计算
+        if(level == LEVELS) {
+            level = LEVELS - 1;
+            expires = m_current + (1ull << (ROOT_BITS + LEVEL_BITS * level)) - 1;
+        }
+    }
+
+    Timer **slot = slotOf(level, expires);
+    timer->m_wheelNext = *slot;
+    if(*slot) {
+        (*slot)->m_wheelPprev = &timer->m_wheelNext;
+    }
+    timer->m_wheelPprev = slot;
+    timer->m_wheelLevel = level;
+    *slot = timer;
+    if(level == 0) {
+        ++m_rootCount;
+    }
+}
+
+void TimerWheel::unlink(Timer *timer) {
+    *timer->m_wheelPprev = timer->m_wheelNext;
+    if(timer->m_wheelNext) {
+        timer->m_wheelNext->m_wheelPprev = timer->m_wheelPprev;
+    }
+    if(timer->m_wheelLevel == 0) {
+        --m_rootCount;
+    }
+    timer->m_wheelNext = nullptr;
+    timer->m_wheelPprev = nullptr;
+    timer->m_wheelLevel = -1;
+}
+
+bool TimerWheel::insert(const Timer::ptr &timer) {
+    AZURE_ASSERT(timer->m_wheelLevel == -1);
+    if(m_count == 0) {
+        // 空闲期间没有推进时间轮，直接跳到当前时间
+        uint64_t now_ms = azure::GetCurrentMS();
+        if(now_ms > m_current) {
+            m_current = now_ms;
+        }
+    }
+    timer->m_self = timer;
+    place(timer.get());
+    ++m_count;
+    if(timer->m_next < m_earliest) {
+        m_earliest = timer->m_next;
         return true;
     }
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(!m_cb) {
+    return false;
+}
+
+bool TimerWheel::erase(const Timer::ptr &timer) {
+    if(timer->m_wheelLevel == -1) {
         return false;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
-        return false;
+    unlink(timer.get());
+    --m_count;
+    timer->m_self.reset();     // timer是调用方持有的引用，这里释放不会析构
+    return true;
+}
+
+void TimerWheel::cascade(int level, uint64_t tick) {
+    Timer **slot = slotOf(level, tick);
+    Timer *timer = *slot;
+    *slot = nullptr;
+    while(timer) {
+        Timer *next = timer->m_wheelNext;
+        place(timer);
+        timer = next;
     }
-    m_manager->m_timers.erase(it);
-    uint64_t start = 0;
-    if(from_now) {
-        start = azure::GetCurrentMS();
+}
+
+void TimerWheel::takeSlot(Timer **slot, std::vector<Timer::ptr> &expired) {
+    while(Timer *timer = *slot) {
+        unlink(timer);
+        --m_count;
+        expired.push_back(timer->m_self);
+        timer->m_self.reset();
+    }
+}
+
+// 第0层直接找最近的非空槽；高层只能知道下一次下放的时间，返回它作为偏早的估计
+uint64_t TimerWheel::nextTime() {
+    if(m_count == 0) {
+        m_earliest = ~0ull;
+        return m_earliest;
+    }
+    uint64_t next = ~0ull;
+    if(m_rootCount > 0) {
+        for(int i = 0; i < ROOT_SIZE; ++i) {
+            if(m_root[(m_current + i) & (ROOT_SIZE - 1)]) {
+                next = m_current + i;
+                break;
+            }
+        }
+    }
+    for(int level = 1; level < LEVELS; ++level) {
+        int shift = ROOT_BITS + LEVEL_BITS * (level - 1);
+        uint64_t block = m_current >> shift;
+        // 当前块的槽只有在 m_current 恰好在块边界（还没处理）时才会再下放
+        int j = (m_current & ((1ull << shift) - 1)) ? 1 : 0;
+        for(; j <= LEVEL_SIZE; ++j) {
+            uint64_t tick = (block + j) << shift;
+            if(tick >= next) {
+                break;
+            }
+            if(m_levels[level - 1][(block + j) & (LEVEL_SIZE - 1)]) {
+                next = tick;
+                break;
+            }
+        }
+    }
+    m_earliest = next;
+    return next;
+}
+
+void TimerWheel::listExpired(uint64_t now_ms, bool rollover, std::vector<Timer::ptr> &expired) {
+    if(rollover) {
+        for(int i = 0; i < ROOT_SIZE; ++i) {
+            takeSlot(&m_root[i], expired);
+        }
+        for(int level = 1; level < LEVELS; ++level) {
+            for(int i = 0; i < LEVEL_SIZE; ++i) {
+                takeSlot(&m_levels[level - 1][i], expired);
+            }
+        }
+        m_current = now_ms;
+        return;
+    }
+
+    while(m_current <= now_ms) {
+        if(m_count == 0) {
+            m_current = now_ms + 1;
+            break;
+        }
+        uint64_t tick = m_current;
+        // 低层转完一圈，依次把高层对应的槽下放
+        if((tick & (ROOT_SIZE - 1)) == 0) {
+            for(int level = 1; level < LEVELS; ++level) {
+                cascade(level, tick);
+                int shift = ROOT_BITS + LEVEL_BITS * (level - 1);
+                if(((tick >> shift) & (LEVEL_SIZE - 1)) != 0) {
+                    break;
+                }
+            }
+        }
+        takeSlot(&m_root[tick & (ROOT_SIZE - 1)], expired);
+        ++m_current;
+        // 第0层为空时直接跳到下一次下放的位置
+        if(m_rootCount == 0) {
+            uint64_t next_cascade = (m_current + ROOT_SIZE - 1) & ~(uint64_t)(ROOT_SIZE - 1);
+            m_current = next_cascade < now_ms + 1 ? next_cascade : now_ms + 1;
+        }
+    }
+}
+
+static ConfigVar<std::string>::ptr g_timer_backend = Config::Lookup<std::string>("timer.backend", "wheel", "timer queue backend, wheel or set");
+
+TimerManager::Shard::Shard() {
+    previousTime = azure::GetCurrentMS();
+    if(g_timer_backend->getValue() == "set") {
+        timers.reset(new TimerSet);
     }
     else {
-        start = m_next - m_ms;
+        timers.reset(new TimerWheel);
     }
-    m_ms = ms;
-    m_next = start + m_ms;
-    m_manager->addTimer(shared_from_this(), lock);
-    return true;
 }
 
 TimerManager::TimerManager() {
-    m_previousTime = azure::GetCurrentMS();
 }
 
 TimerManager::~TimerManager() {
+    // 释放邮箱里定时器对自己的引用
+    drainMailbox(&m_shared);
+    for(auto &i : m_shards) {
+        drainMailbox(i);
+        delete i;
+    }
+}
+
+void TimerManager::initTimerShards(size_t count) {
+    AZURE_ASSERT(m_shards.empty());
+    for(size_t i = 0; i < count; ++i) {
+        m_shards.push_back(new Shard);
+    }
+}
 
+TimerManager::Shard *TimerManager::getShard(int index) {
+    if(index < 0 || index >= (int)m_shards.size()) {
+        return &m_shared;
+    }
+    return m_shards[index];
 }
 
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) {
     Timer::ptr timer(new Timer(ms, cb, recurring, this));
-    RWMutexType::WriteLock lock(m_mutex);
-    addTimer(timer, lock);
+    insertTimer(timer);
     return timer;
 }
 
@@ -113,91 +337,245 @@ Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
     return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
 }
 
-// 获取距离下一次触发定时器所需要的时间
-uint64_t TimerManager::getNextTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    m_tickled = false;
-    if(m_timers.empty()) {
-        return ~0ull;
+void TimerManager::insertTimer(const Timer::ptr &timer) {
+    int index = getTimerShard();
+    Shard *shard = getShard(index);
+    timer->m_shard = shard == &m_shared ? -1 : index;
+    ++shard->count;
+
+    if(shard != &m_shared) {
+        // 本线程正在运行，回到idle之前会重新计算超时时间，不需要唤醒
+        shard->timers->insert(timer);
+        return;
     }
 
-    const Timer::ptr &next = *m_timers.begin();
-    uint64_t now_ms = azure::GetCurrentMS();
-    if(now_ms >= next->m_next) {
-        return 0;
+    bool at_front = false;
+    {
+        MutexType::Lock lock(shard->mutex);
+        at_front = shard->timers->insert(timer) && !shard->tickled;
+        if(at_front) {
+            shard->tickled = true;
+        }
+    }
+    if(at_front) {
+        // 重新设置之前 epoll_wait 设置的超时时间
+        onTimerInsertedAtFront();
+    }
+}
+
+// 调用前定时器已经被置为CANCELLED
+void TimerManager::removeTimer(const Timer::ptr &timer) {
+    Shard *shard = getShard(timer->m_shard);
+    --shard->count;
+    if(shard == &m_shared) {
+        MutexType::Lock lock(shard->mutex);
+        shard->timers->erase(timer);
+        timer->m_cb = nullptr;
+    }
+    else if(timer->m_shard == getTimerShard()) {
+        shard->timers->erase(timer);
+        timer->m_cb = nullptr;
     }
     else {
-        return next->m_next - now_ms;
+        postTimer(shard, timer);
     }
 }
 
-// 获取所有已超时的定时器的回调函数
-void TimerManager::listExpiredCb(std::vector<std::function<void()>> &cbs) {
-    uint64_t now_ms = azure::GetCurrentMS();
-    std::vector<Timer::ptr> expired;
-    {
-        RWMutexType::ReadLock lock(m_mutex);
-        if(m_timers.empty()) {
-            return;
+bool TimerManager::updateTimer(const Timer::ptr &timer, uint64_t ms, uint64_t start) {
+    Shard *shard = getShard(timer->m_shard);
+    if(shard == &m_shared) {
+        bool at_front = false;
+        {
+            MutexType::Lock lock(shard->mutex);
+            if(!applyUpdate(shard, timer, ms, start, &at_front)) {
+                return false;
+            }
+            at_front = at_front && !shard->tickled;
+            if(at_front) {
+                shard->tickled = true;
+            }
+        }
+        if(at_front) {
+            onTimerInsertedAtFront();
         }
+        return true;
+    }
+    if(timer->m_shard == getTimerShard()) {
+        return applyUpdate(shard, timer, ms, start);
     }
 
-    RWMutexType::WriteLock lock(m_mutex);
-    if(m_timers.empty()) {
-        return;
+    // 其他线程的定时器，记下修改交给属主处理
+    // 刷新只会把触发时间往后推，属主最迟在原来的时间醒来处理；reset可能提前，需要唤醒属主
+    timer->m_pendingMs = ms;
+    timer->m_pendingStart = start;
+    timer->m_pendingUpdate = true;
+    postTimer(shard, timer);
+    if(ms != ~0ull) {
+        tickleTimerShard(timer->m_shard);
     }
-    bool rollover = detectClockRollover(now_ms);
-    if(!rollover && ((*m_timers.begin())->m_next > now_ms)) {
+    return true;
+}
+
+// 只在属主线程（或持有共享分片的锁）调用
+bool TimerManager::applyUpdate(Shard *shard, const Timer::ptr &timer, uint64_t ms, uint64_t start, bool *at_front) {
+    if(timer->m_state != Timer::ACTIVE) {
+        return false;
+    }
+    if(ms == timer->m_ms && start == ~0ull) {
+        return true;
+    }
+    if(!shard->timers->erase(timer)) {
+        return false;
+    }
+    if(ms == ~0ull) {
+        ms = timer->m_ms;
+    }
+    if(start == ~0ull) {
+        start = timer->m_next - timer->m_ms;
+    }
+    timer->m_ms = ms;
+    timer->m_next = start + ms;
+    bool front = shard->timers->insert(timer);
+    if(at_front) {
+        *at_front = front;
+    }
+    return true;
+}
+
+void TimerManager::postTimer(Shard *shard, const Timer::ptr &timer) {
+    // 已经在邮箱里了，属主处理时会读到最新的状态
+    if(timer->m_inMailbox.exchange(true)) {
         return;
     }
+    timer->m_mailSelf = timer;
+    Timer *head = shard->mailbox.load(std::memory_order_relaxed);
+    do {
+        timer->m_mailNext = head;
+    } while(!shard->mailbox.compare_exchange_weak(head, timer.get(), std::memory_order_release, std::memory_order_relaxed));
+}
 
-    Timer::ptr now_timer(new Timer(now_ms));
-    auto it = rollover ? m_timers.end() : m_timers.upper_bound(now_timer);
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
+void TimerManager::drainMailbox(Shard *shard) {
+    Timer *list = shard->mailbox.exchange(nullptr, std::memory_order_acquire);
+    while(list) {
+        Timer::ptr timer;
+        timer.swap(list->m_mailSelf);
+        list = list->m_mailNext;
+        timer->m_mailNext = nullptr;
+        // 先清除标记再读取状态，之后的修改要么在这里被看到，要么重新投递
+        timer->m_inMailbox = false;
+
+        if(timer->m_state == Timer::CANCELLED) {
+            shard->timers->erase(timer);
+            timer->m_cb = nullptr;
+        }
+        else if(timer->m_pendingUpdate.exchange(false)) {
+            applyUpdate(shard, timer, timer->m_pendingMs, timer->m_pendingStart);
+        }
+    }
+}
+
+uint64_t TimerManager::nextTime(Shard *shard) {
+    if(shard == &m_shared) {
+        // 共享分片里只有未取消的定时器，count为0时容器为空
+        if(shard->count == 0) {
+            return ~0ull;
+        }
+        MutexType::Lock lock(shard->mutex);
+        shard->tickled = false;
+        return shard->timers->empty() ? ~0ull : shard->timers->nextTime();
+    }
+    drainMailbox(shard);
+    return shard->timers->empty() ? ~0ull : shard->timers->nextTime();
+}
+
+// 获取距离下一次触发定时器所需要的时间
+uint64_t TimerManager::getNextTimer() {
+    uint64_t next = nextTime(&m_shared);
+    Shard *shard = getShard(getTimerShard());
+    if(shard != &m_shared) {
+        uint64_t own = nextTime(shard);
+        next = own < next ? own : next;
+    }
+    if(next == ~0ull) {
+        return ~0ull;
+    }
+
+    uint64_t now_ms = azure::GetCurrentMS();
+    if(now_ms >= next) {
+        return 0;
+    }
+    else {
+        return next - now_ms;
+    }
+}
+
+void TimerManager::listExpired(Shard *shard, std::vector<std::function<void()>> &cbs) {
+    if(shard->timers->empty()) {
+        return;
+    }
+    uint64_t now_ms = azure::GetCurrentMS();
+    std::vector<Timer::ptr> expired;
+    bool rollover = detectClockRollover(shard, now_ms);
+    shard->timers->listExpired(now_ms, rollover, expired);
+    cbs.reserve(cbs.size() + expired.size());
 
     for(auto &timer : expired) {
-        cbs.push_back(timer->m_cb);
         if(timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
+            if(timer->m_state == Timer::ACTIVE) {
+                cbs.push_back(timer->m_cb);
+                timer->m_next = now_ms + timer->m_ms;
+                shard->timers->insert(timer);
+                continue;
+            }
         }
         else {
-            timer->m_cb = nullptr;  // 主要是释放智能指针
+            int expected = Timer::ACTIVE;
+            if(timer->m_state.compare_exchange_strong(expected, Timer::EXPIRED)) {
+                --shard->count;
+                cbs.push_back(std::move(timer->m_cb));
+            }
         }
+        timer->m_cb = nullptr;  // 主要是释放智能指针
     }
 }
 
-void TimerManager::addTimer(Timer::ptr timer, RWMutexType::WriteLock &lock) {
-    auto it = m_timers.insert(timer).first;
-    bool at_front = (it == m_timers.begin() && !m_tickled);
-    if(at_front) {
-        m_tickled = true;
+// 获取所有已超时的定时器的回调函数
+void TimerManager::listExpiredCb(std::vector<std::function<void()>> &cbs) {
+    Shard *shard = getShard(getTimerShard());
+    if(shard != &m_shared) {
+        drainMailbox(shard);
+        listExpired(shard, cbs);
     }
-    lock.unlock();
 
-    if(at_front) {
-        // 重新设置之前 epoll_wait 设置的超时时间
-        onTimerInsertedAtFront();
+    if(m_shared.count == 0) {
+        return;
     }
+    MutexType::Lock lock(m_shared.mutex);
+    listExpired(&m_shared, cbs);
 }
 
 // FIXME 逻辑有问题
 // 处理服务器调整过时间的情况
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
+bool TimerManager::detectClockRollover(Shard *shard, uint64_t now_ms) {
     bool rollover = false;
-    // 当前时间小于m_previousTime，且小于1小时
-    if(now_ms < m_previousTime && now_ms < (m_previousTime - 60 * 60 * 1000)) {
+    // 当前时间小于previousTime，且小于1小时
+    if(now_ms < shard->previousTime && now_ms < (shard->previousTime - 60 * 60 * 1000)) {
         rollover = true;
     }
-    m_previousTime = now_ms;
+    shard->previousTime = now_ms;
     return rollover;
 }
 
 bool TimerManager::hasTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+    if(m_shared.count > 0) {
+        return true;
+    }
+    for(auto &i : m_shards) {
+        if(i->count > 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
-}
\ No newline at end of file
+}
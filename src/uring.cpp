@@ -0,0 +1,169 @@
+#include <unistd.h>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+#include "log.h"
+
+namespace azure {
+
+static azure::Logger::ptr g_logger = AZURE_LOG_NAME("system");
+
+#ifdef AZURE_HAVE_IO_URING
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+static int io_uring_setup(uint32_t entries, io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+Uring::ptr Uring::Create(uint32_t entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = io_uring_setup(entries, &params);
+    if(fd < 0) {
+        AZURE_LOG_WARN(g_logger) << "io_uring_setup(" << entries << ") errno=" << errno << " (" << strerror(errno) << ")";
+        return nullptr;
+    }
+
+    Uring::ptr ring(new Uring);
+    ring->m_fd = fd;
+    // 完成队列溢出时内核要能先缓存起来（5.5+），否则挂起的IO太多时会丢完成事件
+    if(!(params.features & IORING_FEAT_NODROP)) {
+        AZURE_LOG_WARN(g_logger) << "io_uring without IORING_FEAT_NODROP";
+        return nullptr;
+    }
+
+    ring->m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap) {
+        ring->m_sqRingSize = ring->m_cqRingSize = std::max(ring->m_sqRingSize, ring->m_cqRingSize);
+    }
+
+    ring->m_sqRing = mmap(nullptr, ring->m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(ring->m_sqRing == MAP_FAILED) {
+        ring->m_sqRing = nullptr;
+        AZURE_LOG_WARN(g_logger) << "io_uring mmap sq ring errno=" << errno;
+        return nullptr;
+    }
+    if(single_mmap) {
+        ring->m_cqRing = ring->m_sqRing;
+    }
+    else {
+        ring->m_cqRing = mmap(nullptr, ring->m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(ring->m_cqRing == MAP_FAILED) {
+            ring->m_cqRing = nullptr;
+            AZURE_LOG_WARN(g_logger) << "io_uring mmap cq ring errno=" << errno;
+            return nullptr;
+        }
+    }
+
+    ring->m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, ring->m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        AZURE_LOG_WARN(g_logger) << "io_uring mmap sqes errno=" << errno;
+        return nullptr;
+    }
+    ring->m_sqes = (io_uring_sqe*)sqes;
+
+    char *sq = (char*)ring->m_sqRing;
+    ring->m_sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring->m_sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->m_sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->m_sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->m_sqEntries = params.sq_entries;
+    ring->m_sqeTail = ring->m_submitted = *ring->m_sqTail;
+
+    char *cq = (char*)ring->m_cqRing;
+    ring->m_cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->m_cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->m_cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+Uring::~Uring() {
+    if(m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if(m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if(m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+io_uring_sqe *Uring::getSqe() {
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if(m_sqeTail - head >= m_sqEntries) {
+        // 提交队列满了，先交给内核
+        submit();
+        head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if(m_sqeTail - head >= m_sqEntries) {
+            return nullptr;
+        }
+    }
+    unsigned index = m_sqeTail & *m_sqMask;
+    io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[index] = index;
+    ++m_sqeTail;
+    return sqe;
+}
+
+int Uring::submit() {
+    uint32_t to_submit = m_sqeTail - m_submitted;
+    if(to_submit == 0) {
+        return 0;
+    }
+    __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+    int rt = 0;
+    do {
+        rt = io_uring_enter(m_fd, to_submit, 0, 0);
+    } while(rt < 0 && errno == EINTR);
+    if(rt < 0) {
+        // EAGAIN/EBUSY：内核暂时无法接收，留到下一次提交
+        AZURE_LOG_DEBUG(g_logger) << "io_uring_enter(" << m_fd << ", " << to_submit << ") errno=" << errno << " (" << strerror(errno) << ")";
+        return -errno;
+    }
+    m_submitted += rt;
+    return rt;
+}
+
+#else
+
+Uring::ptr Uring::Create(uint32_t entries) {
+    AZURE_LOG_WARN(g_logger) << "io_uring is not supported by this build";
+    return nullptr;
+}
+
+Uring::~Uring() {
+}
+
+io_uring_sqe *Uring::getSqe() {
+    return nullptr;
+}
+
+int Uring::submit() {
+    return -ENOSYS;
+}
+
+#endif
+
+}
@@ -0,0 +1,59 @@
+#ifndef __AZURE_TESTS_ALLOC_BENCH_H__
+#define __AZURE_TESTS_ALLOC_BENCH_H__
+
+// 测试程序共用：统计一段循环的耗时和堆分配次数
+// 这里替换了全局operator new/delete，每个可执行文件只能有一个源文件包含它
+
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+#include <string>
+#include <sstream>
+#include "util.h"
+
+// 统计堆分配次数
+static std::atomic<uint64_t> s_allocs{0};
+
+void *operator new(size_t size) {
+    ++s_allocs;
+    void *p = malloc(size);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+/**
+ * @brief 记录一段循环开始时的时间和分配次数，结束时输出每轮的平均值
+ */
+class AllocBench {
+public:
+    AllocBench(const std::string &name, int loops)
+        : m_name(name)
+        , m_loops(loops)
+        , m_allocs(s_allocs)
+        , m_begin(azure::GetCurrentUS()) {
+    }
+
+    /**
+     * @brief 返回 "name: xx ns/req yy allocs/req"
+     */
+    std::string toString() const {
+        uint64_t us = azure::GetCurrentUS() - m_begin;
+        std::stringstream ss;
+        ss << m_name << ": " << us * 1000.0 / m_loops << "ns/req "
+           << (double)(s_allocs - m_allocs) / m_loops << " allocs/req";
+        return ss.str();
+    }
+private:
+    std::string m_name;
+    int m_loops;
+    uint64_t m_allocs;
+    uint64_t m_begin;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include <sched.h>
+#include <sstream>
+#include "azure.h"
+
+// 各种绑核策略的分配结果，以及工作线程实际绑定的CPU
+
+azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
+
+static std::string cpus_to_string(const std::vector<int> &cpus) {
+    std::stringstream ss;
+    ss << "[";
+    for(size_t i = 0; i < cpus.size(); ++i) {
+        ss << (i ? "," : "") << cpus[i];
+    }
+    ss << "]";
+    return ss.str();
+}
+
+static std::vector<int> current_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for(int i = 0; i < CPU_SETSIZE; ++i) {
+            if(CPU_ISSET(i, &set)) {
+                cpus.push_back(i);
+            }
+        }
+    }
+    return cpus;
+}
+
+void test_plan() {
+    for(auto type : {azure::AffinityPolicy::CPU_LIST, azure::AffinityPolicy::PHYSICAL_CORE, azure::AffinityPolicy::NUMA_NODE}) {
+        azure::AffinityPolicy policy;
+        policy.type = type;
+        policy.cpus = current_cpus();
+        auto plan = policy.plan(4);
+        for(size_t i = 0; i < plan.size(); ++i) {
+            AZURE_LOG_INFO(g_logger) << azure::AffinityPolicy::TypeToString(type) << " thread " << i << " -> "
+                                     << cpus_to_string(plan[i]) << " node=" << (plan[i].empty() ? -1 : azure::GetCpuNumaNode(plan[i][0]));
+            AZURE_ASSERT(!plan[i].empty());
+        }
+    }
+}
+
+void test_scheduler() {
+    // 通过配置指定，和YAML里写 scheduler.affinity: cpu_list 一样
+    std::vector<int> allowed = current_cpus();
+    azure::Config::Lookup<std::string>("scheduler.affinity")->setValue("cpu_list");
+    azure::Config::Lookup<std::vector<int>>("scheduler.affinity_cpus")->setValue({allowed.back()});
+
+    azure::Scheduler sc(2, false, "affinity");
+    sc.start();
+    std::atomic<int> done{0};
+    for(int i = 0; i < 2; ++i) {
+        sc.schedule([&done, &allowed](){
+            std::vector<int> cpus = current_cpus();
+            AZURE_LOG_INFO(g_logger) << azure::Thread::GetName() << " cpus=" << cpus_to_string(cpus);
+            AZURE_ASSERT(cpus.size() == 1 && cpus[0] == allowed.back());
+            ++done;
+        });
+    }
+    sc.stop();
+    AZURE_ASSERT(done == 2);
+    azure::Config::Lookup<std::string>("scheduler.affinity")->setValue("none");
+}
+
+int main(int argc, char **argv) {
+    test_plan();
+    test_scheduler();
+    return 0;
+}
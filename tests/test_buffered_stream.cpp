@@ -0,0 +1,86 @@
+#include "azure.h"
+#include "socket.h"
+#include "address.h"
+#include "buffered_socket_stream.h"
+
+// 按行读写：客户端分几次零碎地发，服务端用readUntil拆行、写缓冲攒着一起回；最后逐字节读
+
+static azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
+
+static const char *ADDR = "127.0.0.1:8025";
+
+void server(azure::Socket::ptr listen) {
+    azure::Socket::ptr client = listen->accept();
+    AZURE_ASSERT(client);
+    azure::BufferedSocketStream::ptr stream(new azure::BufferedSocketStream(client));
+
+    std::string line;
+    while(stream->readUntil(line, "\r\n", 1024) > 0) {
+        if(line == "quit\r\n") {
+            break;
+        }
+        // 回显攒在写缓冲区里，等到没有现成的数据可处理了再一次发出
+        AZURE_ASSERT(stream->write(line.data(), line.size()) == (int)line.size());
+        if(stream->getReadSize() == 0) {
+            AZURE_ASSERT(stream->flush() >= 0);
+        }
+    }
+    // 超过长度限制
+    AZURE_ASSERT(stream->readUntil(line, "\r\n", 8) == -1);
+    AZURE_ASSERT(stream->readUntil(line, "\r\n", 1024) == 17);
+
+    // 逐字节读，一次recv读进来的后面都从缓冲区拿
+    char c;
+    std::string bytes;
+    while(stream->read(&c, 1) == 1) {
+        bytes.push_back(c);
+        if(c == '\n') {
+            break;
+        }
+    }
+    AZURE_ASSERT(bytes == "0123456789abcdef\n");
+    stream->close();
+}
+
+void test_lines() {
+    azure::Address::ptr addr = azure::Address::LookupAnyIPAddress(ADDR);
+    azure::Socket::ptr sock = azure::Socket::CreateTCP(addr);
+    AZURE_ASSERT(sock->connect(addr));
+
+    const char *parts[] = {"hel", "lo\r", "\nwor", "ld\r\nfoo\r\nba", "r\r\n"};
+    for(auto i : parts) {
+        AZURE_ASSERT(sock->send(i, strlen(i)) == (int)strlen(i));
+        usleep(10 * 1000);
+    }
+    std::string expect = "hello\r\nworld\r\nfoo\r\nbar\r\n";
+    std::string data;
+    char buf[256];
+    while(data.size() < expect.size()) {
+        int len = sock->recv(buf, sizeof(buf));
+        AZURE_ASSERT(len > 0);
+        data.append(buf, len);
+    }
+    AZURE_ASSERT(data == expect);
+
+    std::string rest = "quit\r\nno newline here\r\n";
+    AZURE_ASSERT(sock->send(rest.data(), rest.size()) == (int)rest.size());
+    usleep(10 * 1000);
+    std::string bytes = "0123456789abcdef\n";
+    AZURE_ASSERT(sock->send(bytes.data(), bytes.size()) == (int)bytes.size());
+    AZURE_ASSERT(sock->recv(buf, 1) == 0);
+    AZURE_LOG_INFO(g_logger) << "test ok";
+}
+
+void run() {
+    azure::Socket::ptr listen = azure::Socket::CreateTCPSocket();
+    AZURE_ASSERT(listen->bind(azure::Address::LookupAnyIPAddress(ADDR)));
+    AZURE_ASSERT(listen->listen());
+    azure::IOManager::GetThis()->schedule(std::bind(server, listen));
+    test_lines();
+}
+
+int main(int argc, char **argv) {
+    azure::IOManager iom(1);
+    iom.schedule(run);
+    return 0;
+}
@@ -81,7 +81,64 @@ void test() {
 #undef XX
 }
 
+// 分块和连续两种模式：随机位置读、按位置取iovec、clear之后复用
+void test_modes(bool contiguous) {
+    azure::ByteArray::ptr ba(new azure::ByteArray(7, contiguous));
+    std::string expect;
+    for(int i = 0; i < 1000; ++i) {
+        std::string s(rand() % 20, 'a' + i % 26);
+        ba->writeStringWithoutLength(s);
+        expect += s;
+    }
+    AZURE_ASSERT(ba->getSize() == expect.size());
+    for(int i = 0; i < 1000; ++i) {
+        size_t pos = rand() % expect.size();
+        size_t len = rand() % (expect.size() - pos);
+        std::string buf(len, 0);
+        ba->setPosition(pos);
+        ba->read(&buf[0], len);
+        AZURE_ASSERT(buf == expect.substr(pos, len));
+
+        std::vector<iovec> iovs;
+        AZURE_ASSERT(ba->getReadBuffers(iovs, len, pos) == len);
+        std::string data;
+        for(auto &iov : iovs) {
+            data.append((const char*)iov.iov_base, iov.iov_len);
+        }
+        AZURE_ASSERT(data == buf);
+    }
+
+    ba->clear();
+    AZURE_ASSERT(ba->getSize() == 0 && ba->getPosition() == 0);
+    ba->writeStringF32(expect);
+    ba->setPosition(0);
+    AZURE_ASSERT(ba->readStringF32() == expect);
+    AZURE_LOG_INFO(g_logger) << "test_modes contiguous=" << contiguous << " ok";
+}
+
+// 反复创建、写满、释放：块从池里拿，不再每块new一次
+void bench() {
+    std::string data(1000, 'x');
+    for(int n = 0; n < 2; ++n) {
+        for(auto contiguous : {false, true}) {
+            uint64_t begin = azure::GetCurrentUS();
+            for(int i = 0; i < 20000; ++i) {
+                azure::ByteArray ba(4096, contiguous);
+                for(int j = 0; j < 16; ++j) {
+                    ba.writeStringF32(data);
+                }
+                ba.setPosition(0);
+                AZURE_ASSERT(ba.readStringF32().size() == data.size());
+            }
+            AZURE_LOG_INFO(g_logger) << "bench contiguous=" << contiguous << " used=" << (azure::GetCurrentUS() - begin) / 1000 << "ms";
+        }
+    }
+}
+
 int main(int argc, char **argv) {
     test();
+    test_modes(false);
+    test_modes(true);
+    bench();
     return 0;
 }
\ No newline at end of file
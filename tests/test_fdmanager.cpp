@@ -0,0 +1,113 @@
+#include <sys/socket.h>
+#include <stdlib.h>
+#include "azure.h"
+#include "fdmanager.h"
+
+// FdManager::get 每次调用的开销：原来的读写锁+shared_ptr实现和现在的无锁表对比
+
+azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
+
+// 原来的实现：读锁保护的vector，返回shared_ptr的拷贝
+class RWLockFdManager {
+public:
+    typedef azure::RWMutex RWMutexType;
+
+    RWLockFdManager() {
+        m_data.resize(64);
+    }
+
+    std::shared_ptr<azure::FdCtx> get(int fd) {
+        RWMutexType::ReadLock lock(m_mutex);
+        if((int)m_data.size() <= fd) {
+            return nullptr;
+        }
+        return m_data[fd];
+    }
+
+    void set(int fd, azure::FdCtx *ctx) {
+        RWMutexType::WriteLock lock(m_mutex);
+        if((int)m_data.size() <= fd) {
+            m_data.resize(fd * 1.5);
+        }
+        // 对象归FdMgr所有，这里不释放
+        m_data[fd].reset(ctx, [](azure::FdCtx*){});
+    }
+
+private:
+    RWMutexType m_mutex;
+    std::vector<std::shared_ptr<azure::FdCtx>> m_data;
+};
+
+static const int FD_COUNT = 64;
+static int s_loops = 2000000;
+static int s_fds[FD_COUNT];
+static RWLockFdManager s_rwlock_mgr;
+
+static uint64_t bench_rwlock() {
+    uint64_t sum = 0;
+    for(int i = 0; i < s_loops; ++i) {
+        auto ctx = s_rwlock_mgr.get(s_fds[i % FD_COUNT]);
+        sum += ctx->isSocket();
+    }
+    return sum;
+}
+
+static uint64_t bench_lockfree() {
+    uint64_t sum = 0;
+    for(int i = 0; i < s_loops; ++i) {
+        azure::FdCtx *ctx = azure::FdMgr::GetInstance()->get(s_fds[i % FD_COUNT]);
+        sum += ctx->isSocket();
+    }
+    return sum;
+}
+
+static void run(const std::string &name, uint64_t (*fun)(), int threads) {
+    std::vector<azure::Thread::ptr> thrs;
+    std::atomic<uint64_t> sum{0};
+    uint64_t begin = azure::GetCurrentUS();
+    for(int i = 0; i < threads; ++i) {
+        thrs.push_back(azure::Thread::ptr(new azure::Thread([fun, &sum](){
+            sum += fun();
+        }, name + "_" + std::to_string(i))));
+    }
+    for(auto &i : thrs) {
+        i->join();
+    }
+    uint64_t used = azure::GetCurrentUS() - begin;
+    AZURE_LOG_INFO(g_logger) << name << ": threads=" << threads << " calls=" << (uint64_t)s_loops * threads
+                             << " used=" << used << "us "
+                             << (used * 1000.0 / ((double)s_loops * threads)) << "ns/call";
+    AZURE_ASSERT(sum == (uint64_t)s_loops * threads);
+}
+
+int main(int argc, char **argv) {
+    if(argc > 1) {
+        s_loops = atoi(argv[1]);
+    }
+    for(int i = 0; i < FD_COUNT; ++i) {
+        s_fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        azure::FdCtx *ctx = azure::FdMgr::GetInstance()->get(s_fds[i], true);
+        s_rwlock_mgr.set(s_fds[i], ctx);
+    }
+
+    for(int threads : {1, 4}) {
+        run("rwlock+shared_ptr", bench_rwlock, threads);
+        run("lockfree", bench_lockfree, threads);
+    }
+
+    // 关闭后同号fd复用同一个对象，代数变化
+    int fd = s_fds[0];
+    azure::FdCtx *ctx = azure::FdMgr::GetInstance()->get(fd);
+    uint32_t generation = ctx->getGeneration();
+    azure::FdMgr::GetInstance()->del(fd);
+    AZURE_ASSERT(!azure::FdMgr::GetInstance()->get(fd));
+    AZURE_ASSERT(ctx->isClosed());
+    AZURE_ASSERT(azure::FdMgr::GetInstance()->get(fd, true) == ctx);
+    AZURE_ASSERT(!ctx->isClosed() && ctx->getGeneration() != generation);
+    AZURE_LOG_INFO(g_logger) << "reuse fd=" << fd << " generation " << generation << " -> " << ctx->getGeneration();
+
+    for(int i = 0; i < FD_COUNT; ++i) {
+        close(s_fds[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <ucontext.h>
+#include <stdlib.h>
+#include "azure.h"
+
+azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
+
+static const size_t s_stack_size = 128 * 1024;
+static uint64_t s_rounds = 1000000;
+
+static void report(const char *name, uint64_t switches, uint64_t us) {
+    AZURE_LOG_INFO(g_logger) << name << ": " << switches << " switches in " << us << "us, "
+                             << (uint64_t)(switches * 1000000.0 / (us ? us : 1)) << " switches/s, "
+                             << (us * 1000.0 / switches) << "ns/switch";
+}
+
+// ucontext：每次切换都有一次 rt_sigprocmask 系统调用
+static ucontext_t s_uc_main;
+static ucontext_t s_uc_fiber;
+
+static void uc_func() {
+    while(true) {
+        swapcontext(&s_uc_fiber, &s_uc_main);
+    }
+}
+
+void bench_ucontext() {
+    char *stack = (char *)malloc(s_stack_size);
+    getcontext(&s_uc_fiber);
+    s_uc_fiber.uc_link = nullptr;
+    s_uc_fiber.uc_stack.ss_sp = stack;
+    s_uc_fiber.uc_stack.ss_size = s_stack_size;
+    makecontext(&s_uc_fiber, &uc_func, 0);
+
+    uint64_t begin = azure::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i) {
+        swapcontext(&s_uc_main, &s_uc_fiber);
+    }
+    report("ucontext", s_rounds * 2, azure::GetCurrentUS() - begin);
+    free(stack);
+}
+
+#ifndef AZURE_USE_UCONTEXT
+// 汇编实现：只保存被调用者保存的寄存器
+static void *s_asm_main = nullptr;
+static void *s_asm_fiber = nullptr;
+
+static void asm_func() {
+    while(true) {
+        azure_jump_fcontext(&s_asm_fiber, s_asm_main);
+    }
+}
+
+void bench_asm() {
+    char *stack = (char *)malloc(s_stack_size);
+    s_asm_fiber = azure_make_fcontext(stack, s_stack_size, &asm_func);
+
+    uint64_t begin = azure::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i) {
+        azure_jump_fcontext(&s_asm_main, s_asm_fiber);
+    }
+    report("asm", s_rounds * 2, azure::GetCurrentUS() - begin);
+    free(stack);
+}
+#endif
+
+// Fiber 的 call / back，使用编译时选择的实现
+void bench_fiber() {
+    azure::Fiber::GetThis();
+    azure::Fiber *raw = nullptr;
+    azure::Fiber::ptr fiber(new azure::Fiber([&raw](){
+        for(uint64_t i = 0; i < s_rounds; ++i) {
+            raw->back();
+        }
+    }, s_stack_size, true));
+    raw = fiber.get();
+
+    uint64_t begin = azure::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i) {
+        fiber->call();
+    }
+    uint64_t used = azure::GetCurrentUS() - begin;
+    fiber->call();  // 让协程执行完
+    std::string name = std::string("fiber(") + azure::fcontext_backend() + ")";
+    report(name.c_str(), s_rounds * 2, used);
+}
+
+int main(int argc, char **argv) {
+    if(argc > 1) {
+        s_rounds = atoll(argv[1]);
+    }
+    AZURE_LOG_NAME("system")->setLevel(azure::LogLevel::INFO);
+
+    bench_ucontext();
+#ifndef AZURE_USE_UCONTEXT
+    bench_asm();
+#endif
+    bench_fiber();
+    return 0;
+}
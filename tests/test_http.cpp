@@ -1,4 +1,7 @@
 #include "http/http.h"
+#include "log.h"
+#include "macro.h"
+#include "alloc_bench.h"
 
 void test_request() {
     azure::http::HttpRequest::ptr req(new azure::http::HttpRequest);
@@ -16,8 +19,72 @@ void test_response() {
     rsp->dump(std::cout) << std::endl;
 }
 
+// 典型的请求头：插入后查几个常用头部，原来的std::map和现在的HttpHeaders对比
+static const char *s_fields[][2] = {
+    {"Host", "www.baidu.com"},
+    {"User-Agent", "curl/7.68"},
+    {"Accept", "*/*"},
+    {"Accept-Encoding", "gzip"},
+    {"Accept-Language", "zh-CN"},
+    {"Connection", "keep-alive"},
+    {"Content-Type", "text/html"},
+    {"Content-Length", "0"},
+    {"Cache-Control", "no-cache"},
+    {"X-Request-Id", "123456"},
+    {"X-Real-Ip", "10.0.0.1"},
+    {"Referer", "/index"},
+};
+
+template<class Map>
+static void bench_headers(const char *name) {
+    const int loops = 100000;
+    const size_t count = sizeof(s_fields) / sizeof(s_fields[0]);
+    std::string keys[count];
+    for(size_t i = 0; i < count; ++i) {
+        keys[i] = s_fields[i][0];
+    }
+    static const std::string lookups[] = {"host", "connection", "content-length", "x-request-id", "if-none-match"};
+    uint64_t found = 0;
+    AllocBench bench(name, loops);
+    for(int n = 0; n < loops; ++n) {
+        Map headers;
+        for(size_t i = 0; i < count; ++i) {
+            headers[keys[i]] = s_fields[i][1];
+        }
+        for(auto &key : lookups) {
+            found += headers.find(key) != headers.end();
+        }
+    }
+    AZURE_ASSERT(found == loops * 4ul);
+    AZURE_LOG_INFO(AZURE_LOG_ROOT()) << bench.toString();
+}
+
+void test_headers() {
+    azure::http::HttpHeaders headers;
+    headers["Content-Type"] = "text/html";
+    headers["X-A"] = "1";
+    headers["content-type"] = "text/plain";
+    AZURE_ASSERT(headers.size() == 2 && headers.find("CONTENT-TYPE")->second == "text/plain");
+    AZURE_ASSERT(headers.find(azure::http::HttpHeaderId::CONTENT_TYPE)->first == "Content-Type");
+    // 超过内联容量搬到堆上，常用头部的位置跟着变
+    for(int i = 0; i < 40; ++i) {
+        headers["X-" + std::to_string(i)] = std::to_string(i);
+    }
+    AZURE_ASSERT(headers.erase("content-type") == 1 && headers.erase("content-type") == 0);
+    headers["Host"] = "h";
+    AZURE_ASSERT(headers.find("host") == headers.find(azure::http::HttpHeaderId::HOST));
+    azure::http::HttpHeaders copy = headers;
+    azure::http::HttpHeaders moved = std::move(headers);
+    AZURE_ASSERT(copy.size() == 42 && moved.size() == 42 && headers.empty());
+    AZURE_ASSERT(moved.find("x-39")->second == "39" && copy.find("HOST")->second == "h");
+
+    bench_headers<std::map<std::string, std::string, azure::http::CaseInsensitiveLess>>("std::map");
+    bench_headers<azure::http::HttpHeaders>("HttpHeaders");
+}
+
 int main(int argc, char **argv) {
     test_request();
     test_response();
+    test_headers();
     return 0;
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "http/http_parser.h"
 #include "log.h"
+#include "macro.h"
+#include "alloc_bench.h"
 
 static azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
 
@@ -53,9 +55,59 @@ void test_response() {
     AZURE_LOG_INFO(g_logger) << tmp;
 }
 
+const char test_keepalive_data[] =  "GET /azure/index.html?id=10&v=zz#fr HTTP/1.1\r\n"
+                                    "Host: www.baidu.com\r\n"
+                                    "User-Agent: Mozilla/5.0 (X11; Linux x86_64)\r\n"
+                                    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+                                    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+                                    "Accept-Encoding: gzip, deflate\r\n"
+                                    "Cookie: session=0123456789abcdef0123456789abcdef\r\n"
+                                    "Content-Length: 0\r\n"
+                                    "Connection: keep-alive\r\n\r\n";
+
+// 同一个连接上连续解析：原来每个请求新建解析器并拷贝字段，现在复用解析器和请求，字段只记录片段
+void test_request_view() {
+    const int loops = 100000;
+    std::string data = test_keepalive_data;
+
+    AllocBench copy("copy", loops);
+    for(int i = 0; i < loops; ++i) {
+        azure::http::HttpRequestParser parser;
+        std::string tmp = data;
+        parser.execute(&tmp[0], tmp.size());
+        AZURE_ASSERT(parser.isFinished() == 1 && parser.getData()->getPath() == "/azure/index.html");
+    }
+    AZURE_LOG_INFO(g_logger) << copy.toString();
+
+    azure::http::HttpRequestParser parser;
+    azure::http::HttpRequest::ptr req(new azure::http::HttpRequest);
+    AllocBench view("view", loops);
+    for(int i = 0; i < loops; ++i) {
+        req->reset();
+        parser.reset(req);
+        size_t n = parser.parseView(data.data(), data.size());
+        AZURE_ASSERT(n == data.size() && parser.isFinished() == 1 && !parser.hasError());
+        AZURE_ASSERT(req->getPath() == "/azure/index.html");
+        AZURE_ASSERT(parser.getContentLength() == 0);
+    }
+    AZURE_LOG_INFO(g_logger) << view.toString();
+
+    azure::http::StringView val;
+    AZURE_ASSERT(req->getQueryView().toString() == "id=10&v=zz");
+    AZURE_ASSERT(req->getHeaderView("connection", val) && val.equalsIgnoreCase("Keep-Alive"));
+    AZURE_ASSERT(req->getHeader("HOST") == "www.baidu.com");
+    // 修改头部时生成map，和拷贝模式的结果一样
+    req->setHeader("X-Test", "1");
+    AZURE_ASSERT(req->getHeaders().size() == 9 && req->getHeader("cookie").size() == 40);
+    req->detach();
+    AZURE_LOG_INFO(g_logger) << req->toString();
+}
+
 int main(int argc, char **argv) {
     test_request();
     AZURE_LOG_INFO(g_logger) << "-----------------------------------------";
+    test_request_view();
+    AZURE_LOG_INFO(g_logger) << "-----------------------------------------";
     test_response();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "azure.h"
+#include "http/http_server.h"
+
+// HTTP/1.1 流水线：一次发出多个请求，响应按顺序返回；和一问一答对比吞吐
+
+static azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
+
+static const char *ADDR = "127.0.0.1:8024";
+
+static std::string make_request(int i, bool close=false) {
+    std::string body = "body" + std::to_string(i);
+    return "POST /echo?id=" + std::to_string(i) + " HTTP/1.1\r\n"
+           "Host: 127.0.0.1\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+           "Connection: " + (close ? "close" : "keep-alive") + "\r\n\r\n" + body;
+}
+
+// 读到count个响应为止，返回各自的body
+static std::vector<std::string> read_responses(azure::Socket::ptr sock, size_t count) {
+    std::vector<std::string> bodies;
+    std::string data;
+    char buf[64 * 1024];
+    while(bodies.size() < count) {
+        size_t pos = data.find("\r\n\r\n");
+        if(pos != std::string::npos) {
+            size_t cl = data.find("content-length: ");
+            AZURE_ASSERT(cl != std::string::npos && cl < pos);
+            size_t length = atoi(data.c_str() + cl + 16);
+            if(data.size() >= pos + 4 + length) {
+                bodies.push_back(data.substr(pos + 4, length));
+                data.erase(0, pos + 4 + length);
+                continue;
+            }
+        }
+        int len = sock->recv(buf, sizeof(buf));
+        AZURE_ASSERT(len > 0);
+        data.append(buf, len);
+    }
+    AZURE_ASSERT(data.empty());
+    return bodies;
+}
+
+static azure::Socket::ptr connect() {
+    azure::Address::ptr addr = azure::Address::LookupAnyIPAddress(ADDR);
+    azure::Socket::ptr sock = azure::Socket::CreateTCP(addr);
+    AZURE_ASSERT(sock->connect(addr));
+    return sock;
+}
+
+void test_pipeline() {
+    const int count = 200;
+    azure::Socket::ptr sock = connect();
+    std::string reqs;
+    for(int i = 0; i < count; ++i) {
+        reqs += make_request(i);
+    }
+    AZURE_ASSERT(sock->send(reqs.data(), reqs.size()) == (int)reqs.size());
+    auto bodies = read_responses(sock, count);
+    for(int i = 0; i < count; ++i) {
+        AZURE_ASSERT(bodies[i] == std::to_string(i) + ":body" + std::to_string(i));
+    }
+
+    // 最后一个请求要求关闭，之后服务端关连接
+    std::string last = make_request(count, true);
+    AZURE_ASSERT(sock->send(last.data(), last.size()) == (int)last.size());
+    read_responses(sock, 1);
+    char c;
+    AZURE_ASSERT(sock->recv(&c, 1) == 0);
+    AZURE_LOG_INFO(g_logger) << "pipeline " << count << " requests ok";
+}
+
+void bench(int depth) {
+    const int total = 20000;
+    azure::Socket::ptr sock = connect();
+    std::string reqs;
+    for(int i = 0; i < depth; ++i) {
+        reqs += make_request(i);
+    }
+    uint64_t begin = azure::GetCurrentUS();
+    for(int i = 0; i < total / depth; ++i) {
+        AZURE_ASSERT(sock->send(reqs.data(), reqs.size()) == (int)reqs.size());
+        read_responses(sock, depth);
+    }
+    uint64_t used = azure::GetCurrentUS() - begin;
+    AZURE_LOG_INFO(g_logger) << "depth=" << depth << " requests=" << total << " used=" << used / 1000 << "ms "
+                             << "rps=" << (uint64_t)(total * 1000000.0 / used);
+}
+
+void run() {
+    azure::http::HttpServer::ptr server(new azure::http::HttpServer(true));
+    AZURE_ASSERT(server->bind(azure::Address::LookupAnyIPAddress(ADDR)));
+    server->getServletDispatch()->addServlet("/echo", [](azure::http::HttpRequest::ptr req, azure::http::HttpResponse::ptr rsp, azure::http::HttpSession::ptr session) {
+        rsp->setBody(req->getQuery().substr(3) + ":" + req->getBody());
+        return 0;
+    });
+    server->start();
+
+    test_pipeline();
+    bench(1);
+    bench(16);
+    server->stop();
+}
+
+int main(int argc, char **argv) {
+    azure::IOManager iom(2);
+    iom.schedule(run);
+    return 0;
+}
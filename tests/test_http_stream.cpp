@@ -0,0 +1,86 @@
+#include "azure.h"
+#include "http/http_server.h"
+#include "http/http_connection.h"
+
+// 流式响应：chunked分块发送，客户端拼起来和生成的数据一致；HTTP/1.0 直接写body后关闭连接
+
+static azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
+
+static const std::string URL = "http://127.0.0.1:8023";
+static const size_t PIECE = 1000;
+static const size_t PIECES = 4000;
+
+static std::string make_piece(size_t i) {
+    return std::string(PIECE - 1, 'a' + i % 26) + "\n";
+}
+
+void test_chunked() {
+    uint64_t begin = azure::GetCurrentMS();
+    auto r = azure::http::HttpConnection::DoGet(URL + "/stream", 10000);
+    AZURE_ASSERT2(r->response, r->toString());
+    std::string expect;
+    for(size_t i = 0; i < PIECES; ++i) {
+        expect += make_piece(i);
+    }
+    AZURE_LOG_INFO(g_logger) << "chunked body=" << r->response->getBody().size()
+                             << " used=" << azure::GetCurrentMS() - begin << "ms";
+    AZURE_ASSERT(r->response->getBody() == expect);
+    AZURE_ASSERT(r->response->getHeader("Transfer-Encoding") == "chunked");
+
+    r = azure::http::HttpConnection::DoGet(URL + "/empty", 1000);
+    AZURE_ASSERT(r->response && r->response->getBody().empty());
+}
+
+void test_http10() {
+    azure::Address::ptr addr = azure::Address::LookupAnyIPAddress("127.0.0.1:8023");
+    azure::Socket::ptr sock = azure::Socket::CreateTCP(addr);
+    AZURE_ASSERT(sock->connect(addr));
+    std::string req = "GET /stream HTTP/1.0\r\n\r\n";
+    AZURE_ASSERT(sock->send(req.data(), req.size()) == (int)req.size());
+    std::string data;
+    char buf[64 * 1024];
+    int len;
+    while((len = sock->recv(buf, sizeof(buf))) > 0) {
+        data.append(buf, len);
+    }
+    size_t pos = data.find("\r\n\r\n");
+    AZURE_ASSERT(pos != std::string::npos);
+    AZURE_LOG_INFO(g_logger) << "http/1.0 header:" << std::endl << data.substr(0, pos);
+    AZURE_ASSERT(data.substr(0, pos).find("chunked") == std::string::npos);
+    AZURE_ASSERT(data.size() - pos - 4 == PIECE * PIECES);
+}
+
+void run() {
+    azure::http::HttpServer::ptr server(new azure::http::HttpServer(true));
+    azure::Address::ptr addr = azure::Address::LookupAnyIPAddress("127.0.0.1:8023");
+    AZURE_ASSERT(server->bind(addr));
+    auto sd = server->getServletDispatch();
+    sd->addServlet("/stream", [](azure::http::HttpRequest::ptr req, azure::http::HttpResponse::ptr rsp, azure::http::HttpSession::ptr session) {
+        rsp->setHeader("Content-Type", "text/plain");
+        auto writer = session->startStream(rsp);
+        // 先把头部发出去
+        writer->flush();
+        for(size_t i = 0; i < PIECES; ++i) {
+            if(writer->write(make_piece(i)) < 0) {
+                break;
+            }
+        }
+        return 0;
+    });
+    sd->addServlet("/empty", [](azure::http::HttpRequest::ptr req, azure::http::HttpResponse::ptr rsp, azure::http::HttpSession::ptr session) {
+        session->startStream(rsp);
+        return 0;
+    });
+    server->start();
+
+    test_chunked();
+    test_http10();
+    server->stop();
+    AZURE_LOG_INFO(g_logger) << "http stream test ok";
+}
+
+int main(int argc, char **argv) {
+    azure::IOManager iom(2);
+    iom.schedule(run);
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include "azure.h"
 #include "iomanager.h"
+#include "fdmanager.h"
 
 azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
 
@@ -60,7 +61,101 @@ void test_timer() {
     }, true);
 }
 
+// 持久注册模式下fd在另一个IOManager的线程上关闭，同号的新fd还要能等到事件
+void test_persistent_reuse() {
+    azure::Config::Lookup<bool>("iomanager.persistent_events")->setValue(true);
+    azure::IOManager a(1, false, "a");
+    azure::IOManager b(1, false, "b");
+    azure::Semaphore sem;
+    int sv[2];
+    int rt = 0;
+
+    auto wait_read = [&]() {
+        azure::FdMgr::GetInstance()->get(sv[0], true);
+        timeval tv = {1, 0};
+        setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char c;
+        rt = read(sv[0], &c, 1);
+        sem.notify();
+    };
+
+    a.schedule([&]() {
+        AZURE_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+        wait_read();
+    });
+    usleep(100 * 1000);
+    AZURE_ASSERT(write(sv[1], "x", 1) == 1);
+    sem.wait();
+    AZURE_ASSERT(rt == 1);
+
+    // b的线程上关闭，a里这个fd还记着已经注册过
+    int old_fd = sv[0];
+    b.schedule([&]() {
+        close(sv[0]);
+        close(sv[1]);
+        sem.notify();
+    });
+    sem.wait();
+
+    a.schedule([&]() {
+        AZURE_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+        AZURE_ASSERT(sv[0] == old_fd);
+        wait_read();
+    });
+    usleep(100 * 1000);
+    AZURE_ASSERT(write(sv[1], "y", 1) == 1);
+    sem.wait();
+    AZURE_ASSERT(rt == 1);
+    close(sv[0]);
+    close(sv[1]);
+    AZURE_LOG_INFO(g_logger) << "test_persistent_reuse ok";
+    azure::Config::Lookup<bool>("iomanager.persistent_events")->setValue(false);
+}
+
+// iomanager.spin_us大于0时，任务间隔很短的话idle在自旋里就等到了，间隔长了才转入阻塞
+// 等到调度线程至少阻塞过一次再取统计，最多等1秒
+static azure::IOManager::PollStats wait_poll_stats(azure::IOManager &iom) {
+    azure::IOManager::PollStats stats = iom.getPollStats();
+    for(int i = 0; i < 1000 && stats.sleeps == 0; ++i) {
+        usleep(1000);
+        stats = iom.getPollStats();
+    }
+    return stats;
+}
+
+// 命中/未命中的比例取决于调度时机，只检查一定成立的：开自旋后空闲时先自旋，关掉后从不自旋
+void test_poll_stats() {
+    azure::Config::Lookup<uint32_t>("iomanager.spin_us")->setValue(2000);
+    {
+        azure::IOManager iom(1, false, "spin");
+        std::atomic<int> done{0};
+        for(int i = 0; i < 20; ++i) {
+            iom.schedule([&done](){++done;});
+        }
+        for(int i = 0; i < 1000 && done != 20; ++i) {
+            usleep(1000);
+        }
+        azure::IOManager::PollStats stats = wait_poll_stats(iom);
+        AZURE_LOG_INFO(g_logger) << "test_poll_stats done=" << done << " spinHits=" << stats.spinHits
+                                 << " spinMisses=" << stats.spinMisses << " sleeps=" << stats.sleeps;
+        AZURE_ASSERT(done == 20);
+        AZURE_ASSERT(stats.spinHits + stats.spinMisses > 0 && stats.sleeps > 0);
+    }
+    azure::Config::Lookup<uint32_t>("iomanager.spin_us")->setValue(0);
+    {
+        azure::IOManager iom(1, false, "nospin");
+        for(int i = 0; i < 20; ++i) {
+            iom.schedule([](){});
+        }
+        azure::IOManager::PollStats stats = wait_poll_stats(iom);
+        AZURE_ASSERT(stats.spinHits == 0 && stats.spinMisses == 0 && stats.sleeps > 0);
+    }
+}
+
 int main(int argc, char **argv) {
+    // 主线程当过调度线程后hook还开着，不在协程里的usleep会出问题，所以放在前面
+    test_persistent_reuse();
+    test_poll_stats();
     test1();
     // test_timer();
     return 0;
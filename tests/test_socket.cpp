@@ -42,7 +42,32 @@ void test_socket() {
     AZURE_LOG_INFO(g_logger) << buffer;
 }
 
+// 不在IOManager线程里（hook关闭）也能accept
+void test_accept_plain_thread() {
+    azure::Address::ptr addr = azure::Address::LookupAnyIPAddress("127.0.0.1:8031");
+    azure::Socket::ptr listen = azure::Socket::CreateTCP(addr);
+    AZURE_ASSERT(listen->bind(addr));
+    AZURE_ASSERT(listen->listen());
+
+    azure::Socket::ptr client = azure::Socket::CreateTCP(addr);
+    AZURE_ASSERT(client->connect(addr));
+    azure::Socket::ptr accepted = listen->accept();
+    AZURE_ASSERT(accepted);
+
+    azure::Socket::ptr client2 = azure::Socket::CreateTCP(addr);
+    AZURE_ASSERT(client2->connect(addr));
+    std::vector<azure::Socket::ptr> socks;
+    AZURE_ASSERT(listen->accept(socks, 8) == 1);
+
+    // 客户端没有经过hook，是阻塞的
+    AZURE_ASSERT(socks[0]->send("ping", 4) == 4);
+    char buf[4];
+    AZURE_ASSERT(client2->recv(buf, sizeof(buf)) == 4 && memcmp(buf, "ping", 4) == 0);
+    AZURE_LOG_INFO(g_logger) << "accept from plain thread ok";
+}
+
 int main(int argc, char **argv) {
+    test_accept_plain_thread();
     azure::IOManager iom;
     iom.schedule(&test_socket);
     return 0;
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <fcntl.h>
+#include <fstream>
+#include "azure.h"
+#include "http/http_server.h"
+#include "http/http_connection.h"
+#include "http/static_file_servlet.h"
+
+// StaticFileServlet：完整文件、Range、条件请求，大文件走sendfile时发送缓冲区写满要挂起协程
+
+static azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
+
+static std::string s_dir;
+static std::string s_small;
+static std::string s_big;
+static const std::string URL = "http://127.0.0.1:8022/static/";
+
+static std::string make_file(const std::string &name, size_t size) {
+    std::string data(size, '\0');
+    for(size_t i = 0; i < size; ++i) {
+        data[i] = 'a' + (i * 7 + i / 26) % 26;
+    }
+    std::ofstream ofs(s_dir + "/" + name, std::ios::binary);
+    ofs.write(data.data(), data.size());
+    return data;
+}
+
+static azure::http::HttpResponse::ptr get(const std::string &path, const std::map<std::string, std::string> &headers={}) {
+    auto r = azure::http::HttpConnection::DoGet(URL + path, 5000, headers);
+    AZURE_ASSERT2(r->response, r->toString());
+    AZURE_LOG_INFO(g_logger) << "GET " << path << " -> " << (int)r->response->getStatus()
+                             << " length=" << r->response->getBody().size()
+                             << " range=" << r->response->getHeader("Content-Range");
+    return r->response;
+}
+
+void test() {
+    using azure::http::HttpStatus;
+    auto rsp = get("small.txt");
+    AZURE_ASSERT(rsp->getStatus() == HttpStatus::OK && rsp->getBody() == s_small);
+    AZURE_ASSERT(rsp->getHeader("Content-Type") == "text/plain");
+    std::string etag = rsp->getHeader("ETag");
+    std::string last_modified = rsp->getHeader("Last-Modified");
+
+    // 8MB 远超socket发送缓冲区，sendfile会多次EAGAIN
+    rsp = get("big.bin");
+    AZURE_ASSERT(rsp->getStatus() == HttpStatus::OK && rsp->getBody() == s_big);
+
+    rsp = get("small.txt", {{"Range", "bytes=100-199"}});
+    AZURE_ASSERT(rsp->getStatus() == HttpStatus::PARTIAL_CONTENT && rsp->getBody() == s_small.substr(100, 100));
+    AZURE_ASSERT(rsp->getHeader("Content-Range") == "bytes 100-199/" + std::to_string(s_small.size()));
+
+    rsp = get("big.bin", {{"Range", "bytes=-1000"}});
+    AZURE_ASSERT(rsp->getStatus() == HttpStatus::PARTIAL_CONTENT && rsp->getBody() == s_big.substr(s_big.size() - 1000));
+
+    rsp = get("big.bin", {{"Range", "bytes=5000000-"}});
+    AZURE_ASSERT(rsp->getStatus() == HttpStatus::PARTIAL_CONTENT && rsp->getBody() == s_big.substr(5000000));
+
+    rsp = get("small.txt", {{"Range", "bytes=" + std::to_string(s_small.size()) + "-"}});
+    AZURE_ASSERT(rsp->getStatus() == HttpStatus::RANGE_NOT_SATISFIABLE);
+
+    // If-Range 不是当前版本，忽略Range
+    rsp = get("small.txt", {{"Range", "bytes=0-9"}, {"If-Range", "\"old\""}});
+    AZURE_ASSERT(rsp->getStatus() == HttpStatus::OK && rsp->getBody() == s_small);
+
+    rsp = get("small.txt", {{"If-None-Match", etag}});
+    AZURE_ASSERT(rsp->getStatus() == HttpStatus::NOT_MODIFIED && rsp->getBody().empty());
+    rsp = get("small.txt", {{"If-None-Match", "\"other\""}});
+    AZURE_ASSERT(rsp->getStatus() == HttpStatus::OK);
+    rsp = get("small.txt", {{"If-Modified-Since", last_modified}});
+    AZURE_ASSERT(rsp->getStatus() == HttpStatus::NOT_MODIFIED);
+
+    rsp = get("missing.txt");
+    AZURE_ASSERT(rsp->getStatus() == HttpStatus::NOT_FOUND);
+    rsp = get("../static/small.txt");
+    AZURE_ASSERT(rsp->getStatus() == HttpStatus::NOT_FOUND);
+
+    // 文件被替换后，缓存过期时重新打开
+    sleep(1);
+    s_small = make_file("small.txt", 1000);
+    usleep(200 * 1000);
+    rsp = get("small.txt");
+    AZURE_ASSERT(rsp->getBody() == s_small && rsp->getHeader("ETag") != etag);
+}
+
+// 文件在发送时变短了：头部已经按原长度发出，服务端只能关连接，客户端不用等到超时
+void test_shrunk() {
+    uint64_t begin = azure::GetCurrentMS();
+    auto r = azure::http::HttpConnection::DoGet("http://127.0.0.1:8022/shrunk", 5000, {{"Connection", "keep-alive"}});
+    uint64_t used = azure::GetCurrentMS() - begin;
+    AZURE_LOG_INFO(g_logger) << "GET shrunk -> result=" << r->result << " used=" << used << "ms";
+    AZURE_ASSERT(!r->response && used < 2000);
+}
+
+void run() {
+    azure::Config::Lookup<uint64_t>("http.static_file.cache_ttl")->setValue(100);
+    azure::http::HttpServer::ptr server(new azure::http::HttpServer(true));
+    azure::Address::ptr addr = azure::Address::LookupAnyIPAddress("127.0.0.1:8022");
+    AZURE_ASSERT(server->bind(addr));
+    server->getServletDispatch()->addGlobServlet("/static/*",
+            azure::http::StaticFileServlet::ptr(new azure::http::StaticFileServlet(s_dir, "/static")));
+    server->getServletDispatch()->addServlet("/shrunk", [](azure::http::HttpRequest::ptr req
+                , azure::http::HttpResponse::ptr rsp, azure::http::HttpSession::ptr session) {
+        int fd = open((s_dir + "/small.txt").c_str(), O_RDONLY);
+        rsp->setFileBody(azure::http::FileBody::ptr(new azure::http::FileBody(fd)), 0, s_small.size() + 4096);
+        return 0;
+    });
+    server->start();
+
+    test();
+    test_shrunk();
+    server->stop();
+    AZURE_LOG_INFO(g_logger) << "static file test ok";
+}
+
+int main(int argc, char **argv) {
+    char tmpl[] = "/tmp/azure_static_XXXXXX";
+    s_dir = mkdtemp(tmpl);
+    s_small = make_file("small.txt", 10000);
+    s_big = make_file("big.bin", 8 * 1024 * 1024);
+    {
+        azure::IOManager iom(2);
+        iom.schedule(run);
+    }
+    unlink((s_dir + "/small.txt").c_str());
+    unlink((s_dir + "/big.bin").c_str());
+    rmdir(s_dir.c_str());
+    return 0;
+}
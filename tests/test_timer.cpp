@@ -0,0 +1,153 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <atomic>
+#include "azure.h"
+
+// TimerManager 不同实现（timer.backend: set / wheel）的插入、取消、超时性能对比
+
+azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
+
+class BenchTimerManager : public azure::TimerManager {
+protected:
+    void onTimerInsertedAtFront() override {}
+};
+
+static int s_count = 100000;
+
+void bench(const std::string &backend) {
+    azure::Config::Lookup<std::string>("timer.backend")->setValue(backend);
+    BenchTimerManager mgr;
+
+    std::vector<azure::Timer::ptr> timers;
+    timers.reserve(s_count);
+    int fired = 0;
+    srand(1);
+
+    // 模拟连接的读写超时：随机的超时时间
+    uint64_t begin = azure::GetCurrentUS();
+    for(int i = 0; i < s_count; ++i) {
+        timers.push_back(mgr.addTimer(1000 + rand() % 60000, [&fired](){++fired;}));
+    }
+    uint64_t insert_us = azure::GetCurrentUS() - begin;
+
+    // 大部分IO在超时之前就完成了
+    begin = azure::GetCurrentUS();
+    for(int i = 0; i < s_count; ++i) {
+        timers[i]->cancel();
+    }
+    uint64_t cancel_us = azure::GetCurrentUS() - begin;
+    timers.clear();
+
+    // 短超时的定时器全部到期
+    for(int i = 0; i < s_count; ++i) {
+        mgr.addTimer(rand() % 50, [&fired](){++fired;});
+    }
+    usleep(60 * 1000);
+    std::vector<std::function<void()>> cbs;
+    begin = azure::GetCurrentUS();
+    mgr.listExpiredCb(cbs);
+    for(auto &cb : cbs) {
+        cb();
+    }
+    uint64_t expire_us = azure::GetCurrentUS() - begin;
+
+    AZURE_LOG_INFO(g_logger) << backend << ": count=" << s_count
+                             << " insert=" << insert_us << "us"
+                             << " cancel=" << cancel_us << "us"
+                             << " expire=" << expire_us << "us"
+                             << " fired=" << fired
+                             << " left=" << mgr.hasTimer();
+    AZURE_ASSERT(fired == s_count);
+    AZURE_ASSERT(!mgr.hasTimer());
+}
+
+// 检查定时器不会提前触发，也不会漏掉
+void check(const std::string &backend) {
+    azure::Config::Lookup<std::string>("timer.backend")->setValue(backend);
+    BenchTimerManager mgr;
+
+    int fired = 0;
+    int early = 0;
+    int total = 0;
+    std::vector<azure::Timer::ptr> cancelled;
+    for(int i = 0; i < 2000; ++i) {
+        uint64_t ms = rand() % 1500;
+        uint64_t expect = azure::GetCurrentMS() + ms;
+        auto timer = mgr.addTimer(ms, [&fired, &early, expect](){
+            ++fired;
+            if(azure::GetCurrentMS() < expect) {
+                ++early;
+            }
+        });
+        if(i % 3 == 0) {
+            cancelled.push_back(timer);
+        }
+        else {
+            ++total;
+        }
+    }
+    for(auto &i : cancelled) {
+        i->cancel();
+    }
+
+    while(mgr.hasTimer()) {
+        uint64_t next = mgr.getNextTimer();
+        if(next != ~0ull && next > 0) {
+            usleep(next * 1000);
+        }
+        std::vector<std::function<void()>> cbs;
+        mgr.listExpiredCb(cbs);
+        for(auto &cb : cbs) {
+            cb();
+        }
+    }
+    AZURE_LOG_INFO(g_logger) << backend << ": check fired=" << fired << " expect=" << total << " early=" << early;
+    AZURE_ASSERT(fired == total && early == 0);
+}
+
+// 其他线程把定时器reset得更早，属主线程要被唤醒，不能等到原来的时间
+void check_cross_thread_reset() {
+    azure::IOManager iom(2, false);
+    azure::Semaphore sem;
+    azure::Timer::ptr timer;
+    std::atomic<uint64_t> fired_ms{0};
+    iom.schedule([&](){
+        timer = azure::IOManager::GetThis()->addTimer(2000, [&fired_ms](){
+            fired_ms = azure::GetCurrentMS();
+        });
+        sem.notify();
+    });
+    sem.wait();
+    usleep(100 * 1000);
+    uint64_t begin = azure::GetCurrentMS();
+    AZURE_ASSERT(timer->reset(100, true));
+    usleep(600 * 1000);
+    AZURE_LOG_INFO(g_logger) << "cross thread reset: fired after " << (fired_ms ? fired_ms - begin : 0) << "ms";
+    AZURE_ASSERT(fired_ms && fired_ms - begin < 600);
+}
+
+// use_caller的主线程进入run()之前加的定时器也要按时触发
+void check_use_caller() {
+    azure::IOManager iom(2, true);
+    std::atomic<uint64_t> fired_ms{0};
+    uint64_t begin = azure::GetCurrentMS();
+    iom.addTimer(50, [&fired_ms](){
+        fired_ms = azure::GetCurrentMS();
+    });
+    usleep(300 * 1000);
+    AZURE_LOG_INFO(g_logger) << "use_caller: fired after " << (fired_ms ? fired_ms - begin : 0) << "ms";
+    AZURE_ASSERT(fired_ms && fired_ms - begin < 300);
+}
+
+int main(int argc, char **argv) {
+    if(argc > 1) {
+        s_count = atoi(argv[1]);
+    }
+    check_cross_thread_reset();
+    check_use_caller();
+    check("set");
+    check("wheel");
+    bench("set");
+    bench("wheel");
+    return 0;
+}
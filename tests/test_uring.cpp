@@ -0,0 +1,149 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "azure.h"
+
+// 同一组hook的socket操作分别跑在epoll和io_uring后端上：回显、读超时、阻塞时被close
+
+azure::Logger::ptr g_logger = AZURE_LOG_ROOT();
+
+static int s_port = 18931;
+static int s_conns = 50;
+static int s_msgs = 200;
+static std::atomic<int> s_ok{0};
+static std::atomic<int> s_bad{0};
+
+static sockaddr_in get_addr() {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(s_port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr.s_addr);
+    return addr;
+}
+
+static int connect_server() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = get_addr();
+    if(connect(fd, (const sockaddr*)&addr, sizeof(addr))) {
+        AZURE_LOG_ERROR(g_logger) << "connect errno=" << errno;
+        ++s_bad;
+    }
+    return fd;
+}
+
+void echo(int fd) {
+    char buf[256];
+    while(true) {
+        iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len = sizeof(buf);
+        ssize_t n = readv(fd, &iov, 1);
+        if(n <= 0 || send(fd, buf, n, 0) != n) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+void client(int id);
+void test_timeout();
+void test_close();
+
+void server() {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr = get_addr();
+    bind(listen_fd, (const sockaddr*)&addr, sizeof(addr));
+    listen(listen_fd, 1024);
+
+    // 开始监听之后再启动客户端
+    azure::IOManager *iom = azure::IOManager::GetThis();
+    for(int i = 0; i < s_conns; ++i) {
+        iom->schedule(std::bind(client, i));
+    }
+    iom->schedule(test_timeout);
+    iom->schedule(test_close);
+
+    for(int i = 0; i < s_conns + 2; ++i) {
+        sockaddr_in peer;
+        socklen_t len = sizeof(peer);
+        int fd = accept(listen_fd, (sockaddr*)&peer, &len);
+        if(fd < 0) {
+            AZURE_LOG_ERROR(g_logger) << "accept errno=" << errno;
+            ++s_bad;
+            break;
+        }
+        azure::IOManager::GetThis()->schedule(std::bind(echo, fd));
+    }
+    close(listen_fd);
+}
+
+void client(int id) {
+    int fd = connect_server();
+    for(int i = 0; i < s_msgs; ++i) {
+        std::string msg = "hello " + std::to_string(id) + " " + std::to_string(i);
+        char buf[256];
+        if(write(fd, msg.data(), msg.size()) != (ssize_t)msg.size()
+                || read(fd, buf, sizeof(buf)) != (ssize_t)msg.size()
+                || memcmp(buf, msg.data(), msg.size())) {
+            ++s_bad;
+            break;
+        }
+    }
+    ++s_ok;
+    close(fd);
+}
+
+void test_timeout() {
+    int fd = connect_server();
+    timeval tv = {0, 200 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char buf[16];
+    uint64_t begin = azure::GetCurrentMS();
+    ssize_t rt = recv(fd, buf, sizeof(buf), 0);
+    uint64_t used = azure::GetCurrentMS() - begin;
+    AZURE_LOG_INFO(g_logger) << "timeout recv rt=" << rt << " errno=" << errno << " used=" << used << "ms";
+    if(rt != -1 || errno != ETIMEDOUT) {
+        ++s_bad;
+    }
+    close(fd);
+}
+
+void test_close() {
+    int fd = connect_server();
+    azure::IOManager::GetThis()->addTimer(100, [fd](){
+        close(fd);
+    });
+
+    char buf[16];
+    ssize_t rt = recv(fd, buf, sizeof(buf), 0);
+    AZURE_LOG_INFO(g_logger) << "closed recv rt=" << rt << " errno=" << errno;
+    if(rt != -1 || errno != EBADF) {
+        ++s_bad;
+    }
+}
+
+void run(bool use_uring) {
+    azure::Config::Lookup<bool>("iomanager.io_uring")->setValue(use_uring);
+    s_ok = 0;
+    uint64_t begin = azure::GetCurrentMS();
+    {
+        azure::IOManager iom(2, false);
+        iom.schedule(server);
+        AZURE_LOG_INFO(g_logger) << "io_uring=" << use_uring << " useUring=" << iom.useUring();
+    }
+    AZURE_LOG_INFO(g_logger) << "io_uring=" << use_uring << " ok=" << s_ok << " bad=" << s_bad
+                             << " used=" << (azure::GetCurrentMS() - begin) << "ms";
+    AZURE_ASSERT(s_ok == s_conns && s_bad == 0);
+}
+
+int main(int argc, char **argv) {
+    run(false);
+    run(true);
+    return 0;
+}